@@ -1,17 +1,56 @@
 #include <algorithm>
+#include <atomic>
+#include <bitset>
 #include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <exception>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <random>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
+#if defined( __GNUC__ ) && defined( __SSE2__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define SPELLCHECKER_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 bool const Debug = false;
 
+#ifdef SPELLCHECKER_STATS
+bool const Stats = true;
+#else
+bool const Stats = false;
+#endif
+
 /*
  * SimpleArray
  */
@@ -88,11 +127,6 @@ struct SimpleArray
  * Utils
  */
 
-template< typename T >
-bool contain( std::vector< T > const & array, T const & value ){
-    return std::find( array.begin(), array.end(), value ) != array.end();
-}
-
 template< typename T > 
 void test( T const & t ){
     using namespace std::chrono;
@@ -138,6 +172,7 @@ struct Node{
 
     char letter_ = 0;
     bool end_ = false;
+    unsigned char frequency_ = 0;
     SimpleArray< Node * > children_;
 };
 
@@ -155,694 +190,6724 @@ Node * getOrCreate( Node * const node, char const c ){
     return result;
 }
 
-struct TrieStats{
-    TrieStats( Node const * const root ){
-        traverse( root );
-    }
+/*
+ * MappedFile
+ */
 
-    void traverse( Node const * const node ){
-        nodesCounter_ += 1;
-        childrenCounter_ += node->children_.size();
+struct MappedFile{
+    MappedFile( std::string const & fileName )
+        : data_( nullptr )
+        , size_( 0 )
+    {
+        int const fd = ::open( fileName.c_str(), O_RDONLY );
 
-        if( node->end_ ){
-            wordsCounter_ += 1;
+        if( fd == -1 ){
+            throw std::runtime_error( "Can't open file: " + fileName );
         }
 
-        if( node->children_.size() == 0 ){
-            leavesCounter_ += 1;
+        struct stat status;
+
+        if( ::fstat( fd, & status ) == -1 ){
+            ::close( fd );
+            throw std::runtime_error( "Can't stat file: " + fileName );
         }
-        else{
-            if( node->children_.size() == 1 ){
-                nodeWithOneChildCounter_ += 1;
-            }
 
-            for( auto const & c : node->children_ ){
-                traverse( c );
+        size_ = status.st_size;
+
+        if( size_ != 0 ){
+            void * const data = ::mmap( nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+            if( data == MAP_FAILED ){
+                ::close( fd );
+                throw std::runtime_error( "Can't map file: " + fileName );
             }
+
+            data_ = static_cast< char const * >( data );
         }
+
+        ::close( fd );
     }
 
-    unsigned nodesCounter_ = 0;
-    unsigned leavesCounter_ = 0;
-    unsigned childrenCounter_ = 0;
-    unsigned wordsCounter_ = 0;
-    unsigned nodeWithOneChildCounter_ = 0;
+    MappedFile( MappedFile const & ) = delete;
+    MappedFile( MappedFile && ) = delete;
+
+    ~MappedFile(){
+        if( data_ != nullptr ){
+            ::munmap( const_cast< char * >( data_ ), size_ );
+        }
+    }
+
+    MappedFile & operator=( MappedFile const & ) = delete;
+    MappedFile & operator=( MappedFile && ) = delete;
+
+    char const * data_;
+    std::size_t size_;
 };
 
 /*
- * Keyboard Layout
+ * Alphabet
+ *
+ * The trie stores one byte per letter. ASCII letters are stored as they
+ * are, other code points of the dictionary get symbols from First up,
+ * in order of appearance, Unknown stands for code points the dictionary
+ * does not have and decodes to U+FFFD. Bytes of the dictionary which are
+ * not valid UTF-8 are kept as symbols of their own, so every dictionary
+ * word survives encode and decode, input the dictionary has no symbols
+ * for does not.
  */
 
-std::string const polishKeyboardLayout(
-    "|1|2|3|4|5|6|7|8|9|0|-|=|\n"
-    " |q|w|e|r|t|y|u|i|o|p|[|\n"
-    "  |a|s|d|f|g|h|j|k|l|;|'|\n"
-    "   |z|x|c|v|b|n|m|,|.|/|"
-);
+struct Alphabet{
+    static unsigned const First = 128;
+    static unsigned const Size = 127;
+    static unsigned char const Unknown = 255;
 
-std::string const polishKeyboardShiftLayout(
-    "|!|@|#|$|%|^|&|*|(|)|_|+|\n"
-    " |Q|W|E|R|T|Y|U|I|O|P|{|\n"
-    "  |A|S|D|F|G|H|J|K|L|:|\"|\n"
-    "   |Z|X|C|V|B|N|M|<|>|?|"
-);
+    /*
+     * pseudo code point of a byte which is not valid UTF-8
+     */
 
-struct KeyboardLayout{
-    struct Position{
-        unsigned x_;
-        unsigned y_;
-        unsigned z_;
+    static std::uint32_t const RawByte = 0x80000000;
 
-        unsigned distance( Position const & other ) const {
-            unsigned const distance =
-                abs( x_ - other.x_ ) +
-                abs( y_ - other.y_ ) +
-                abs( z_ - other.z_ );
+    Alphabet(){
+        std::fill( codePoints_, codePoints_ + Size, 0 );
+    }
 
-            return distance;
+    static bool ascii( char const * begin, char const * const end ){
+        for( ; begin != end ; ++ begin ){
+            if( static_cast< unsigned char >( * begin ) >= 0x80 ){
+                return false;
+            }
         }
-    };
 
-    void addLayout( unsigned id, std::istream & input ){
-        unsigned lineNo = 0;
-        std::string line;
+        return true;
+    }
 
-        while( std::getline( input, line ) ){
-            char c = 0;
-            unsigned i = 0;
+    /*
+     * reads one code point and moves begin past it
+     */
 
-            while( i < line.size() ){
-                c = line[ i++ ];
-                
-                if( c == '|' ){
-                    break;
-                }
-            }
+    static std::uint32_t readUtf8( char const * & begin, char const * const end ){
+        unsigned char const first = * begin ++;
 
-            while( i < line.size() ){
-                c = line[ i++ ];
+        unsigned length = 0;
+        std::uint32_t result = 0;
 
-                if( c != ' ' ){
-                    if( layout_.count( c ) > 0 ){
-                        throw std::runtime_error( "invalid keyboard layout (1)" );
-                    }
+        if( first < 0x80 ){
+            return first;
+        }
+        else if( ( first & 0xE0 ) == 0xC0 ){
+            length = 1;
+            result = first & 0x1F;
+        }
+        else if( ( first & 0xF0 ) == 0xE0 ){
+            length = 2;
+            result = first & 0x0F;
+        }
+        else if( ( first & 0xF8 ) == 0xF0 ){
+            length = 3;
+            result = first & 0x07;
+        }
+        else{
+            return RawByte | first;
+        }
 
-                    layout_[ c ] = Position{ id, lineNo, i };
-                }
+        if( std::size_t( end - begin ) < length ){
+            return RawByte | first;
+        }
 
-                c = line[ i++ ];
+        for( unsigned i = 0 ; i < length ; ++ i ){
+            unsigned char const next = begin[ i ];
 
-                if( c != '|' ){
-                    throw std::runtime_error( "invalid keyboard layout (2)" );
-                }
+            if( ( next & 0xC0 ) != 0x80 ){
+                return RawByte | first;
             }
 
+            result = ( result << 6 ) | ( next & 0x3F );
+        }
+
+        begin += length;
+        return result;
+    }
 
-            lineNo += 1;
+    static void writeUtf8( std::uint32_t const codePoint, std::string & output ){
+        if( codePoint & RawByte ){
+            output.push_back( char( codePoint & 0xFF ) );
+        }
+        else if( codePoint < 0x80 ){
+            output.push_back( char( codePoint ) );
+        }
+        else if( codePoint < 0x800 ){
+            output.push_back( char( 0xC0 | ( codePoint >> 6 ) ) );
+            output.push_back( char( 0x80 | ( codePoint & 0x3F ) ) );
+        }
+        else if( codePoint < 0x10000 ){
+            output.push_back( char( 0xE0 | ( codePoint >> 12 ) ) );
+            output.push_back( char( 0x80 | ( ( codePoint >> 6 ) & 0x3F ) ) );
+            output.push_back( char( 0x80 | ( codePoint & 0x3F ) ) );
+        }
+        else{
+            output.push_back( char( 0xF0 | ( codePoint >> 18 ) ) );
+            output.push_back( char( 0x80 | ( ( codePoint >> 12 ) & 0x3F ) ) );
+            output.push_back( char( 0x80 | ( ( codePoint >> 6 ) & 0x3F ) ) );
+            output.push_back( char( 0x80 | ( codePoint & 0x3F ) ) );
         }
     }
 
-    unsigned distance( char c1, char c2 ) const {
-        if( layout_.count( c1 ) == 0 ){
-            return -1;
+    /*
+     * the lower case letter of an upper case one of ASCII, Latin-1 or
+     * Latin Extended-A ( Polish included ), other code points as they are
+     */
+
+    static std::uint32_t toLower( std::uint32_t const codePoint ){
+        if( ( codePoint >= 'A' && codePoint <= 'Z' ) || ( codePoint >= 0xC0 && codePoint <= 0xDE && codePoint != 0xD7 ) ){
+            return codePoint + 0x20;
         }
 
-        if( layout_.count( c2 ) == 0 ){
-            return -1;
+        if( codePoint == 0x130 ){
+            return 'i';
         }
 
-        return layout_.find( c1 )->second.distance( layout_.find( c2 )->second );
-    }
+        if( codePoint == 0x178 ){
+            return 0xFF;
+        }
 
-    std::map< char, Position > layout_;
-};
+        if( ( codePoint >= 0x100 && codePoint <= 0x137 ) || ( codePoint >= 0x14A && codePoint <= 0x177 ) ){
+            return codePoint | 1;
+        }
 
-/*
- * PenaltyPolicy
- */
+        if( ( codePoint >= 0x139 && codePoint <= 0x148 ) || ( codePoint >= 0x179 && codePoint <= 0x17E ) ){
+            return codePoint + ( codePoint & 1 );
+        }
 
-struct PenaltyPolicy{
-    PenaltyPolicy( KeyboardLayout const * keyboardLayout )
-        : keyboardLayout_( keyboardLayout )
-    
-    {
+        return codePoint;
     }
 
-    virtual ~PenaltyPolicy(){
-    }
+    unsigned char symbol( std::uint32_t const codePoint ) const {
+        if( codePoint < 0x80 ){
+            return codePoint;
+        }
 
-    virtual int maxNumberOfMistakes( int const wordLength ) const {
-        return std::max( 3, wordLength );
-    }
+        for( unsigned i = 0 ; i < Size && codePoints_[ i ] != 0 ; ++ i ){
+            if( codePoints_[ i ] == codePoint ){
+                return First + i;
+            }
+        }
 
-    virtual int swapLetter( char const currentLetter, char const nextLetter ) const {
-        return 2;
+        return Unknown;
     }
 
-    virtual int insertLetter( char const currentLetter, char const insertedLetter, char const nextLetter = char( 0 ) ) const {
-        return 3;
-    }
+    std::uint32_t codePoint( unsigned char const symbol ) const {
+        if( symbol < First ){
+            return symbol;
+        }
 
-    virtual int replaceLetter( char const currentLetter, char const replaceLetter, char const nextLetter = char( 0 ) ) const {
+        if( symbol == Unknown || codePoints_[ symbol - First ] == 0 ){
+            return 0xFFFD;
+        }
 
-        unsigned distance1 = keyboardLayout_->distance( currentLetter, replaceLetter );
+        return codePoints_[ symbol - First ];
+    }
 
-        if( distance1 == -1 ){
-            distance1 = 4;
-        }
+    /*
+     * the symbol of a code point, a new one if it has none yet
+     */
 
-        if( distance1 > 4 ){
-            distance1 = 4;
-        }
+    unsigned char add( std::uint32_t const codePoint ){
+        unsigned char const result = symbol( codePoint );
 
-        if( distance1 == 0 ){
-            distance1 = 2;
+        if( result != Unknown ){
+            return result;
         }
 
-        if( nextLetter == char( 0 ) ){
-            return distance1;
+        for( unsigned i = 0 ; i < Size ; ++ i ){
+            if( codePoints_[ i ] == 0 ){
+                codePoints_[ i ] = codePoint;
+                return First + i;
+            }
         }
 
+        throw std::runtime_error( "Alphabet: more than 127 non-ASCII letters" );
+    }
 
-        unsigned distance2 = keyboardLayout_->distance( replaceLetter, nextLetter );
-
-        if( distance2 == -1 ){
-            distance2 = 4;
+    std::string encode( char const * begin, char const * const end ) const {
+        if( ascii( begin, end ) ){
+            return std::string( begin, end );
         }
 
-        if( distance2 > 4 ){
-            distance2 = 4;
-        }
+        std::string result;
 
-        if( distance2 == 0 ){
-            distance2 = 2;
+        while( begin != end ){
+            result.push_back( char( symbol( readUtf8( begin, end ) ) ) );
         }
 
-        return std::min( distance1, distance2 );
+        return result;
     }
 
-    virtual int exactMatch( char const currentLetter = char( 0 ) ) const {
-        return 0;
+    std::string encode( std::string const & word ) const {
+        return encode( word.data(), word.data() + word.size() );
     }
 
-    virtual int deleteLetter( char const previousLetter, char const currentLetter, char const nextLetter = char( 0 ) ) const {
-        return 3;
+    void decode( std::string & word ) const {
+        if( ascii( word.data(), word.data() + word.size() ) ){
+            return;
+        }
+
+        std::string result;
+
+        for( char const c : word ){
+            writeUtf8( codePoint( c ), result );
+        }
+
+        word.swap( result );
     }
 
-    KeyboardLayout const * keyboardLayout_;
+    std::uint32_t codePoints_[ Size ];
 };
 
+unsigned const Alphabet::First;
+unsigned const Alphabet::Size;
+unsigned char const Alphabet::Unknown;
+std::uint32_t const Alphabet::RawByte;
+
 /*
- * TrieIterator
+ * FlatTrie
+ *
+ * Immutable trie compiled from Node. Nodes are numbered breadth first,
+ * so children of a node occupy consecutive indices [ first, first + count ),
+ * their letters are looked up in a contiguous letters_ array.
+ *
+ * The arrays live in one image which is also the on-disk format, so a
+ * compiled dictionary is mapped and queried without deserialization.
+ * The image holds only indices and offsets, it is position independent.
  */
 
-struct TrieIterator{
-    TrieIterator(
-        Node * const root,
-        int const penalty,
-        std::vector< TrieIterator * > & iterators,
-        PenaltyPolicy * penaltyPolicy,
-        std::string const & word,
-        std::string const & debug
+struct FlatTrie{
+    typedef std::uint32_t Index;
+
+    static Index const Root = 0;
+    static Index const None = Index( -1 );
+
+    static std::uint32_t const Version = 4;
+    static std::uint32_t const ByteOrder = 0x01020304;
+
+    /*
+     * Header::flags_
+     */
+
+    static std::uint32_t const Minimized = 1;
+    static std::uint32_t const Frequencies = 2;
+
+    /*
+     * ends_[ node ] has EndFlag set for the last letter of a word, the
+     * other bits hold the quantized frequency of the word, 0 if unknown
+     */
+
+    static unsigned char const EndFlag = 1;
+    static unsigned const MaxFrequency = 127;
+
+    /*
+     * Children of a node are a contiguous run of letters_. Runs longer than
+     * VectorThreshold are compared 16 ( SSE2 ) or 32 ( AVX2 ) letters at
+     * a time, so images written here have LettersPadding readable bytes
+     * after the letters. Images without them are searched letter by letter.
+     */
+
+    static std::uint64_t const LettersPadding = 32;
+    static unsigned const VectorThreshold = 8;
+
+    struct Header{
+        char magic_[ 8 ];
+        std::uint32_t version_;
+        std::uint32_t byteOrder_;
+        std::uint32_t flags_;
+        std::uint32_t reserved_;
+        std::uint64_t imageSize_;
+        std::uint64_t size_;
+        std::uint64_t letters_;
+        std::uint64_t ends_;
+        std::uint64_t first_;
+        std::uint64_t count_;
+        std::uint64_t alphabet_;
+    };
 
-    )
-        : iterators_( iterators )
-        , penaltyPolicy_( penaltyPolicy )
-        , penalty_( penalty )
-        , node_( root )
-        , word_( word )
-        , debug_( debug )
-    {
+    static char const * magic(){
+        return "SPELLCHK";
     }
 
-    virtual void move( char const c, char const nextLetter = char( 0 ) );
-    
-    int getPenalty() const {
-        return penalty_;
+    static std::uint64_t align( std::uint64_t const offset ){
+        return ( offset + 7 ) & ~ std::uint64_t( 7 );
     }
 
-    std::vector< TrieIterator * > & iterators_;
-    PenaltyPolicy * penaltyPolicy_;
-    int penalty_;
-    Node * node_;
-    std::string word_;
-    std::string debug_;
-};
-
-struct SkipIteration
-    : TrieIterator{
+    /*
+     * four levels per doubling of the frequency, frequencies up to 2^31
+     * keep their order
+     */
 
-    SkipIteration(
-        Node * const root,
-        int const penalty,
-        std::vector< TrieIterator * > & iterators,
-        PenaltyPolicy * penaltyPolicy,
-        std::string const & word,
-        std::string const & debug
-    )
-        : TrieIterator(
-            root,
-            penalty,
-            iterators,
-            penaltyPolicy,
-            word,
-            debug )
-        , skip_( true ){
-    }
-
-    void move( char const c, char const nextLetter ) override{
-        if( skip_ ){
-            skip_ = false;
-            return;
+    static unsigned char quantize( std::uint64_t const frequency ){
+        if( frequency == 0 ){
+            return 0;
         }
 
-        TrieIterator::move( c, nextLetter );
+        return std::min< unsigned >( MaxFrequency, 1 + unsigned( 4 * std::log2( double( frequency ) ) ) );
     }
 
-    bool skip_;
-};
+    /*
+     * Writer allocates an image for a given number of nodes and exposes
+     * its arrays for filling in
+     */
+
+    struct Writer{
+        Writer( std::uint64_t const size, std::uint32_t const flags, Alphabet const & alphabet )
+            : image_( new std::vector< char >() )
+        {
+            std::memset( & header_, 0, sizeof( Header ) );
+            std::copy( magic(), magic() + sizeof( header_.magic_ ), header_.magic_ );
+            header_.version_ = Version;
+            header_.byteOrder_ = ByteOrder;
+            header_.flags_ = flags;
+            header_.size_ = size;
+            header_.letters_ = align( sizeof( Header ) );
+            header_.ends_ = align( header_.letters_ + size + LettersPadding );
+            header_.first_ = align( header_.ends_ + size );
+            header_.count_ = align( header_.first_ + size * sizeof( Index ) );
+            header_.alphabet_ = align( header_.count_ + size );
+            header_.imageSize_ = align( header_.alphabet_ + sizeof( Alphabet::codePoints_ ) );
+
+            image_->resize( header_.imageSize_, 0 );
+
+            char * const data = image_->data();
+            std::memcpy( data, & header_, sizeof( Header ) );
+
+            letters_ = data + header_.letters_;
+            ends_ = reinterpret_cast< unsigned char * >( data + header_.ends_ );
+            first_ = reinterpret_cast< Index * >( data + header_.first_ );
+            count_ = reinterpret_cast< unsigned char * >( data + header_.count_ );
+
+            std::memcpy( data + header_.alphabet_, alphabet.codePoints_, sizeof( Alphabet::codePoints_ ) );
+        }
 
-void TrieIterator::move( char const c, char const nextLetter ){
-    if( nextLetter != char( 0 ) ){
+        FlatTrie finish() const {
+            return FlatTrie( image_, image_->data(), header_.imageSize_ );
+        }
 
-        auto const nextLetterIt = node_->children_.find( nextLetter );
-
-        if( nextLetterIt != node_->children_.end() ){
-            auto const cIt = ( * nextLetterIt )->children_.find( c );
-
-            if( cIt != ( * nextLetterIt )->children_.end() ){
-                iterators_.push_back(
-                    new SkipIteration(
-                        * cIt,
-                        penalty_ + penaltyPolicy_->swapLetter( c, nextLetter ),
-                        iterators_,
-                        penaltyPolicy_,
-                        word_ + std::string( 1, nextLetter ) + std::string( 1, c ),
-                        debug_ + "S"
-                    )
-                );
+        Header header_;
+        std::shared_ptr< std::vector< char > > image_;
+        char * letters_;
+        unsigned char * ends_;
+        Index * first_;
+        unsigned char * count_;
+    };
+
+    static FlatTrie compile( Node const * const root, Alphabet const & alphabet = Alphabet() ){
+        std::vector< Node const * > queue( 1, root );
+
+        for( Index current = 0 ; current < queue.size() ; ++ current ){
+            for( auto const & child : queue[ current ]->children_ ){
+                queue.push_back( child );
             }
         }
-    }
 
-    for( auto const & node : node_->children_ ){
-        auto const cIt = node->children_.find( c );
+        std::uint32_t flags = 0;
 
-        if( cIt != node->children_.end() ){
-            iterators_.push_back(
-                new TrieIterator(
-                    * cIt,
-                    penalty_ + penaltyPolicy_->insertLetter( c, node->letter_, nextLetter ),
-                    iterators_,
-                    penaltyPolicy_,
-                    word_ + std::string( 1, node->letter_ ) + std::string( 1, c ),
-                    debug_ + "I"
-                )
-            );
+        for( Node const * const node : queue ){
+            if( node->end_ && node->frequency_ != 0 ){
+                flags |= Frequencies;
+            }
         }
-    }
 
-    for( auto const & node : node_->children_ ){
-        if( node->letter_ == c ){
-            iterators_.push_back(
-                new TrieIterator(
-                    node,
-                    penalty_ + penaltyPolicy_->exactMatch( node->letter_ ),
-                    iterators_,
-                    penaltyPolicy_,
-                    word_ + std::string( 1, node->letter_ ),
-                    debug_ + "E"
-                )
-            );
-        }
-        else{
-            iterators_.push_back(
-                new TrieIterator(
-                    node,
-                    penalty_ + penaltyPolicy_->replaceLetter( c, node->letter_, nextLetter ),
-                    iterators_,
-                    penaltyPolicy_,
-                    word_ + std::string( 1, node->letter_ ),
-                    debug_ + "R"
-                )
-            );
-        }
-    }
+        Writer writer( queue.size(), flags, alphabet );
+        Index next = 1;
 
-    char const previousLetter = word_.size() < 2 ? char( 0 ) : word_[ word_.size() - 2 ];
-    penalty_ += penaltyPolicy_->deleteLetter( previousLetter, c, nextLetter );
-    debug_ += "D";
-}
+        for( Index current = 0 ; current < queue.size() ; ++ current ){
+            Node const * const node = queue[ current ];
 
-/*
- * SpellCheckerBase
- */
+            writer.letters_[ current ] = node->letter_;
+            writer.ends_[ current ] = node->end_ ? ( node->frequency_ << 1 ) | EndFlag : 0;
+            writer.first_[ current ] = next;
+            writer.count_[ current ] = static_cast< unsigned char >( node->children_.size() );
 
-struct SpellCheckerBase{
-    typedef std::vector< TrieIterator * >::const_iterator iterator;
-    typedef std::vector< TrieIterator * >::const_iterator const_iterator;
+            next += node->children_.size();
+        }
 
-    SpellCheckerBase()
-        : counter_( 0 )
-        , trie_( new Node ){
+        return writer.finish();
     }
 
-    SpellCheckerBase( SpellCheckerBase const & ) = delete;
-    SpellCheckerBase( SpellCheckerBase && ) = delete;
+    /*
+     * Builds a minimized directed acyclic word graph: nodes with the same
+     * letter, end flag and equivalent children are merged, and nodes with
+     * equivalent children share one range of child entries. Child order is
+     * kept, so the search visits words exactly as in the trie. Ranges are
+     * laid out from the highest subtrees down, so children still follow
+     * their parents.
+     */
 
-    virtual ~SpellCheckerBase(){
-        trie_->free();
-    }
-
-    SpellCheckerBase & operator=( SpellCheckerBase const & ) = delete;
-    SpellCheckerBase & operator=( SpellCheckerBase && ) = delete;
+    static FlatTrie minimize( FlatTrie const & trie ){
+        typedef std::vector< Index > Children;
 
-    void init( PenaltyPolicy * penaltyPolicy ){
-        counter_ = 0;
+        /*
+         * children are numbered after their parents, so classes are
+         * assigned bottom up in a single backward pass
+         */
 
-        penaltyPolicy_ = penaltyPolicy;
+        std::vector< Index > classOf( trie.size() );
+        std::vector< Index > representative;
+        std::vector< unsigned > height;
+        std::unordered_map< std::string, Index > classes;
 
-        iterators_.clear();
-        iterators_.push_back(
-            new TrieIterator(
-                trie_,
-                0,
-                iterators_,
-                penaltyPolicy_,
-                "",
-                ""
-            )
-        );
-    }
+        std::string key;
 
-    void finalize(){
-        std::for_each(
-            iterators_.begin(),
-            iterators_.end(),
-            []( TrieIterator const * const node ){ delete node; }
-        );
+        for( Index node = trie.size() ; node -- > 0 ; ){
+            key.assign( 1, trie.letter( node ) );
+            key.push_back( char( trie.ends_[ node ] ) );
 
-        iterators_.clear();
-    }
+            unsigned nodeHeight = 0;
 
-    void readDictFile( std::string const & fileName ){
-        std::ifstream file( fileName.c_str() );
-        
-        if( ! file ){
-            throw std::runtime_error( "Can't open file: " + fileName );
-        }
+            for( Index child = trie.begin( node ) ; child != trie.end( node ) ; ++ child ){
+                key.append( reinterpret_cast< char const * >( & classOf[ child ] ), sizeof( Index ) );
+                nodeHeight = std::max( nodeHeight, height[ classOf[ child ] ] + 1 );
+            }
 
-        std::string line;
-        
-        while( std::getline( file, line ) ){
-            Node * node = trie_;
-            
-            for( unsigned i = 0 ; i < line.size() ; ++ i ){
-                node = getOrCreate( node, line[i] );
+            auto const inserted = classes.emplace( key, Index( representative.size() ) );
 
-                if( i + 1 == line.size() ){
-                    node->end_ = true;
-                }
+            if( inserted.second ){
+                representative.push_back( node );
+                height.push_back( nodeHeight );
             }
-        }
-    }
 
-    void processLetter( char const c, char const nextLetterHint = char(0) ){
-        for( unsigned current = 0, end = iterators_.size() ; current != end ; ++ current ){
-            iterators_[ current ]->move( c, nextLetterHint );
+            classOf[ node ] = inserted.first->second;
         }
 
-        //std::cout << "Iterator counter: " << iterators_.size() << std::endl;
+        /*
+         * ranges of child entries, one per distinct list of child classes,
+         * in order of discovery from the root
+         */
 
-        int const penalty = penaltyPolicy_->maxNumberOfMistakes( ++ counter_ );
+        std::map< Children, Index > ranges;
+        std::vector< Children const * > rangeChildren;
+        std::vector< unsigned > rangeHeight;
+        std::vector< Index > rangeOf( representative.size(), None );
+        std::vector< Index > pending( 1, classOf[ Root ] );
 
-        auto const toBeRemoved = std::partition(
-            iterators_.begin(),
-            iterators_.end(),
-            [ penalty ]( TrieIterator const * const node ){ return node->getPenalty() <= penalty; }
-        );
+        while( pending.empty() == false ){
+            Index const cls = pending.back();
+            pending.pop_back();
 
-        std::for_each(
-            toBeRemoved,
-            iterators_.end(),
-            []( TrieIterator const * const node ){ delete node; }
-        );
+            if( rangeOf[ cls ] != None ){
+                continue;
+            }
 
-        iterators_.erase( toBeRemoved, iterators_.end() );
-    }
+            Index const node = representative[ cls ];
 
-    iterator begin() const {
-        return iterators_.begin();
-    }
+            Children children;
 
-    iterator end() const {
-        return iterators_.end();
-    }
+            for( Index child = trie.begin( node ) ; child != trie.end( node ) ; ++ child ){
+                children.push_back( classOf[ child ] );
+            }
 
-    unsigned counter_;
-    Node * trie_;
-    std::vector< TrieIterator * > iterators_;
-    PenaltyPolicy * penaltyPolicy_;
-};
+            auto const inserted = ranges.emplace( children, Index( rangeChildren.size() ) );
 
-/*
- * SpellChecker
+            if( inserted.second ){
+                rangeChildren.push_back( & inserted.first->first );
+                rangeHeight.push_back( height[ cls ] );
+                pending.insert( pending.end(), children.rbegin(), children.rend() );
+            }
+
+            rangeOf[ cls ] = inserted.first->second;
+        }
+
+        /*
+         * a child range is lower than the class of its parent, so ranges
+         * ordered by height come after every entry pointing to them
+         */
+
+        std::vector< Index > order( rangeChildren.size() );
+
+        for( Index range = 0 ; range < order.size() ; ++ range ){
+            order[ range ] = range;
+        }
+
+        std::stable_sort( order.begin(), order.end(), [ & rangeHeight ]( Index const lhs, Index const rhs ){
+            return rangeHeight[ lhs ] > rangeHeight[ rhs ];
+        } );
+
+        std::vector< Index > start( rangeChildren.size() );
+        std::vector< Index > entries( 1, classOf[ Root ] );
+
+        for( Index const range : order ){
+            start[ range ] = entries.size();
+            entries.insert( entries.end(), rangeChildren[ range ]->begin(), rangeChildren[ range ]->end() );
+        }
+
+        Writer writer( entries.size(), Minimized | ( trie.flags_ & Frequencies ), trie.alphabet_ );
+
+        for( Index entry = 0 ; entry < entries.size() ; ++ entry ){
+            Index const node = representative[ entries[ entry ] ];
+
+            writer.letters_[ entry ] = trie.letter( node );
+            writer.ends_[ entry ] = trie.ends_[ node ];
+            writer.first_[ entry ] = start[ rangeOf[ entries[ entry ] ] ];
+            writer.count_[ entry ] = trie.count_[ node ];
+        }
+
+        return writer.finish();
+    }
+
+    static bool isCompiled( std::string const & fileName ){
+        std::ifstream file( fileName.c_str(), std::ios::binary );
+        char buffer[ 8 ] = { 0 };
+        file.read( buffer, sizeof( buffer ) );
+
+        return file && std::equal( buffer, buffer + sizeof( buffer ), magic() );
+    }
+
+    static FlatTrie map( std::string const & fileName ){
+        std::shared_ptr< MappedFile > const file( new MappedFile( fileName ) );
+
+        return FlatTrie( file, file->data_, file->size_ );
+    }
+
+    FlatTrie()
+        : image_( nullptr )
+        , size_( 0 )
+        , flags_( 0 )
+        , letters_( nullptr )
+        , ends_( nullptr )
+        , first_( nullptr )
+        , count_( nullptr )
+        , padded_( false )
+    {
+    }
+
+    FlatTrie( std::shared_ptr< void const > const & storage, char const * const image, std::uint64_t const imageSize )
+        : storage_( storage )
+        , image_( image )
+    {
+        if( imageSize < sizeof( Header ) ){
+            throw std::runtime_error( "invalid dictionary image (1)" );
+        }
+
+        Header header;
+        std::memcpy( & header, image, sizeof( Header ) );
+
+        if( std::equal( header.magic_, header.magic_ + sizeof( header.magic_ ), magic() ) == false ){
+            throw std::runtime_error( "invalid dictionary image (2)" );
+        }
+
+        if( header.byteOrder_ != ByteOrder ){
+            throw std::runtime_error( "invalid dictionary image (3)" );
+        }
+
+        if( header.version_ != Version ){
+            throw std::runtime_error( "unsupported dictionary version" );
+        }
+
+        if( header.imageSize_ != imageSize || header.size_ == 0 || header.size_ >= None ){
+            throw std::runtime_error( "invalid dictionary image (4)" );
+        }
+
+        auto const fits = [ imageSize ]( std::uint64_t const offset, std::uint64_t const size ){
+            return offset <= imageSize && size <= imageSize - offset;
+        };
+
+        if( fits( header.alphabet_, sizeof( Alphabet::codePoints_ ) ) == false ){
+            throw std::runtime_error( "invalid dictionary image (5)" );
+        }
+
+        if( fits( header.letters_, header.size_ ) == false
+            || fits( header.ends_, header.size_ ) == false
+            || fits( header.first_, header.size_ * sizeof( Index ) ) == false
+            || fits( header.count_, header.size_ ) == false
+            || header.first_ % alignof( Index ) != 0
+        ){
+            throw std::runtime_error( "invalid dictionary image (6)" );
+        }
+
+        size_ = Index( header.size_ );
+        flags_ = header.flags_;
+        letters_ = image + header.letters_;
+        ends_ = reinterpret_cast< unsigned char const * >( image + header.ends_ );
+        first_ = reinterpret_cast< Index const * >( image + header.first_ );
+        count_ = reinterpret_cast< unsigned char const * >( image + header.count_ );
+        padded_ = header.ends_ >= header.letters_ + header.size_ + LettersPadding;
+
+        std::memcpy( alphabet_.codePoints_, image + header.alphabet_, sizeof( Alphabet::codePoints_ ) );
+    }
+
+    /*
+     * The constructor checks only the header and the sections, a node is
+     * checked when its children are first read: they have to stay within
+     * the trie and come after the node, so a search never reads past the
+     * image and never walks in a loop. Nodes which are never reached are
+     * never read.
+     */
+
+    Index first( Index const node ) const {
+        Index const first = first_[ node ];
+
+        if( first <= node || std::uint64_t( first ) + count_[ node ] > size_ ){
+            invalidNode();
+        }
+
+        return first;
+    }
+
+    __attribute__(( noinline, cold ))
+    static void invalidNode(){
+        throw std::runtime_error( "invalid dictionary image (7)" );
+    }
+
+    void save( std::string const & fileName ) const {
+        std::ofstream file( fileName.c_str(), std::ios::binary );
+
+        Header header;
+        std::memcpy( & header, image_, sizeof( Header ) );
+
+        if( ! file.write( image_, header.imageSize_ ) ){
+            throw std::runtime_error( "Can't write file: " + fileName );
+        }
+    }
+
+    bool contains( char const * begin, char const * const end, Index node = Root ) const {
+        node = find( begin, end, node );
+        return node != None && isEnd( node );
+    }
+
+    /*
+     * the node reached by the letters [ begin, end ), None if there is none
+     */
+
+    Index find( char const * begin, char const * const end, Index node = Root ) const {
+        for( ; begin != end && node != None ; ++ begin ){
+            node = find( node, * begin );
+        }
+
+        return node;
+    }
+
+    Index find( Index const node, char const c ) const {
+        Index const first = this->first( node );
+        unsigned const count = count_[ node ];
+
+#ifdef SPELLCHECKER_X86_SIMD
+        if( count > VectorThreshold && padded_ ){
+            return HasAvx2 ? findAvx2( first, count, c ) : findSse2( first, count, c );
+        }
+#endif
+
+        return findScalar( first, count, c );
+    }
+
+    Index findScalar( Index const first, unsigned const count, char const c ) const {
+        for( Index child = first, last = first + count ; child != last ; ++ child ){
+            if( letters_[ child ] == c ){
+                return child;
+            }
+        }
+
+        return None;
+    }
+
+#ifdef SPELLCHECKER_X86_SIMD
+    static bool const HasAvx2;
+
+    static bool hasAvx2(){
+        __builtin_cpu_init();
+        return __builtin_cpu_supports( "avx2" );
+    }
+
+    Index findSse2( Index const first, unsigned const count, char const c ) const {
+        __m128i const letter = _mm_set1_epi8( c );
+
+        for( unsigned offset = 0 ; offset < count ; offset += 16 ){
+            __m128i const letters = _mm_loadu_si128( reinterpret_cast< __m128i const * >( letters_ + first + offset ) );
+            unsigned mask = _mm_movemask_epi8( _mm_cmpeq_epi8( letters, letter ) );
+
+            if( count - offset < 16 ){
+                mask &= ( 1u << ( count - offset ) ) - 1;
+            }
+
+            if( mask != 0 ){
+                return first + offset + __builtin_ctz( mask );
+            }
+        }
+
+        return None;
+    }
+
+    __attribute__(( target( "avx2" ) ))
+    Index findAvx2( Index const first, unsigned const count, char const c ) const {
+        __m256i const letter = _mm256_set1_epi8( c );
+
+        for( unsigned offset = 0 ; offset < count ; offset += 32 ){
+            __m256i const letters = _mm256_loadu_si256( reinterpret_cast< __m256i const * >( letters_ + first + offset ) );
+            unsigned mask = _mm256_movemask_epi8( _mm256_cmpeq_epi8( letters, letter ) );
+
+            if( count - offset < 32 ){
+                mask &= ( 1u << ( count - offset ) ) - 1;
+            }
+
+            if( mask != 0 ){
+                return first + offset + __builtin_ctz( mask );
+            }
+        }
+
+        return None;
+    }
+#endif
+
+    Index begin( Index const node ) const {
+        return first( node );
+    }
+
+    /*
+     * children are read from begin(), which checks the node
+     */
+
+    Index end( Index const node ) const {
+        return first_[ node ] + count_[ node ];
+    }
+
+    unsigned children( Index const node ) const {
+        return count_[ node ];
+    }
+
+    char letter( Index const node ) const {
+        return letters_[ node ];
+    }
+
+    bool isEnd( Index const node ) const {
+        return ( ends_[ node ] & EndFlag ) != 0;
+    }
+
+    unsigned frequency( Index const node ) const {
+        return ends_[ node ] >> 1;
+    }
+
+    unsigned size() const {
+        return size_;
+    }
+
+    bool minimized() const {
+        return ( flags_ & Minimized ) != 0;
+    }
+
+    bool frequencies() const {
+        return ( flags_ & Frequencies ) != 0;
+    }
+
+    std::uint64_t bytes() const {
+        Header header;
+        std::memcpy( & header, image_, sizeof( Header ) );
+        return header.imageSize_;
+    }
+
+    std::shared_ptr< void const > storage_;
+    char const * image_;
+    Index size_;
+    std::uint32_t flags_;
+    char const * letters_;
+    unsigned char const * ends_;
+    Index const * first_;
+    unsigned char const * count_;
+    bool padded_;
+    Alphabet alphabet_;
+};
+
+FlatTrie::Index const FlatTrie::Root;
+FlatTrie::Index const FlatTrie::None;
+std::uint32_t const FlatTrie::Version;
+std::uint32_t const FlatTrie::ByteOrder;
+std::uint32_t const FlatTrie::Minimized;
+std::uint32_t const FlatTrie::Frequencies;
+unsigned char const FlatTrie::EndFlag;
+unsigned const FlatTrie::MaxFrequency;
+std::uint64_t const FlatTrie::LettersPadding;
+unsigned const FlatTrie::VectorThreshold;
+
+#ifdef SPELLCHECKER_X86_SIMD
+bool const FlatTrie::HasAvx2 = FlatTrie::hasAvx2();
+#endif
+
+struct TrieStats{
+    TrieStats( FlatTrie const & trie ){
+        for( FlatTrie::Index node = 0 ; node < trie.size() ; ++ node ){
+            unsigned const children = trie.children( node );
+
+            nodesCounter_ += 1;
+            childrenCounter_ += children;
+
+            if( trie.isEnd( node ) ){
+                wordsCounter_ += 1;
+            }
+
+            if( children == 0 ){
+                leavesCounter_ += 1;
+            }
+            else if( children == 1 ){
+                nodeWithOneChildCounter_ += 1;
+            }
+        }
+
+        bytesCounter_ = trie.bytes();
+    }
+
+    void print( std::ostream & output ) const {
+        output << "Nodes counter: " << nodesCounter_ << std::endl;
+        output << "Leaves counter: " << leavesCounter_ << std::endl;
+        output << "Avg. children/node: " << 1.0 * childrenCounter_ / nodesCounter_ << std::endl;
+        output << "Words counter: " << wordsCounter_ << std::endl;
+        output << "Node with one child: " << nodeWithOneChildCounter_ << std::endl;
+        output << "Bytes: " << bytesCounter_ << std::endl;
+    }
+
+    unsigned nodesCounter_ = 0;
+    unsigned leavesCounter_ = 0;
+    unsigned childrenCounter_ = 0;
+    unsigned wordsCounter_ = 0;
+    unsigned nodeWithOneChildCounter_ = 0;
+    std::uint64_t bytesCounter_ = 0;
+};
+
+/*
+ * TrieDepths
+ *
+ * For every node the longest and the shortest distance down to an end
+ * node, and the highest frequency of a word ending in its subtree.
+ * Children follow their parents in a compiled trie, so one pass
+ * backwards is enough. Nodes merged by minimize() have equal subtrees,
+ * so the values hold for a minimized trie as well.
+ */
+
+struct TrieDepths{
+    TrieDepths( FlatTrie const & trie )
+        : height_( trie.size(), 0 )
+        , endDepth_( trie.size(), 0 )
+        , maxFrequency_( trie.size(), 0 )
+    {
+        for( FlatTrie::Index node = trie.size() ; node -- != 0 ; ){
+            unsigned height = 0;
+            unsigned endDepth = std::numeric_limits< std::uint16_t >::max();
+            unsigned maxFrequency = trie.frequency( node );
+
+            for( FlatTrie::Index child = trie.begin( node ) ; child != trie.end( node ) ; ++ child ){
+                height = std::max< unsigned >( height, height_[ child ] + 1 );
+                endDepth = std::min< unsigned >( endDepth, endDepth_[ child ] + 1 );
+                maxFrequency = std::max< unsigned >( maxFrequency, maxFrequency_[ child ] );
+            }
+
+            height_[ node ] = height;
+            endDepth_[ node ] = trie.isEnd( node ) ? 0 : endDepth;
+            maxFrequency_[ node ] = maxFrequency;
+        }
+    }
+
+    std::vector< std::uint16_t > height_;
+    std::vector< std::uint16_t > endDepth_;
+    std::vector< unsigned char > maxFrequency_;
+};
+
+/*
+ * Keyboard Layout
  */
 
-struct SpellChecker : SpellCheckerBase{
-    SpellChecker( std::string const & fileName ){
-        readDictFile( fileName );
+std::string const polishKeyboardLayout(
+    "|1|2|3|4|5|6|7|8|9|0|-|=|\n"
+    " |q|w|e|r|t|y|u|i|o|p|[|\n"
+    "  |a|s|d|f|g|h|j|k|l|;|'|\n"
+    "   |z|x|c|v|b|n|m|,|.|/|"
+);
+
+std::string const polishKeyboardShiftLayout(
+    "|!|@|#|$|%|^|&|*|(|)|_|+|\n"
+    " |Q|W|E|R|T|Y|U|I|O|P|{|\n"
+    "  |A|S|D|F|G|H|J|K|L|:|\"|\n"
+    "   |Z|X|C|V|B|N|M|<|>|?|"
+);
+
+struct KeyboardLayout{
+    KeyboardLayout(){
+        buildReplaceCosts();
+    }
+
+    struct Position{
+        unsigned x_;
+        unsigned y_;
+        unsigned z_;
+
+        unsigned distance( Position const & other ) const {
+            unsigned const distance =
+                abs( int( x_ - other.x_ ) ) +
+                abs( int( y_ - other.y_ ) ) +
+                abs( int( z_ - other.z_ ) );
+
+            return distance;
+        }
+    };
+
+    void addLayout( unsigned id, std::istream & input ){
+        unsigned lineNo = 0;
+        std::string line;
+
+        while( std::getline( input, line ) ){
+            char c = 0;
+            unsigned i = 0;
+
+            while( i < line.size() ){
+                c = line[ i++ ];
+                
+                if( c == '|' ){
+                    break;
+                }
+            }
+
+            while( i < line.size() ){
+                c = line[ i++ ];
+
+                if( c != ' ' ){
+                    if( layout_.count( c ) > 0 ){
+                        throw std::runtime_error( "invalid keyboard layout (1)" );
+                    }
+
+                    layout_[ c ] = Position{ id, lineNo, i };
+                }
+
+                c = line[ i++ ];
+
+                if( c != '|' ){
+                    throw std::runtime_error( "invalid keyboard layout (2)" );
+                }
+            }
+
+
+            lineNo += 1;
+        }
+
+        buildReplaceCosts();
+    }
+
+    unsigned distance( char c1, char c2 ) const {
+        if( layout_.count( c1 ) == 0 ){
+            return -1;
+        }
+
+        if( layout_.count( c2 ) == 0 ){
+            return -1;
+        }
+
+        return layout_.find( c1 )->second.distance( layout_.find( c2 )->second );
+    }
+
+    /*
+     * distance clamped to a replace penalty: 2 for the same key, 4 for
+     * keys far apart or not on the keyboard
+     */
+
+    static unsigned char replaceCost( unsigned const distance ){
+        if( distance > 4 ){
+            return 4;
+        }
+
+        if( distance == 0 ){
+            return 2;
+        }
+
+        return distance;
+    }
+
+    int replaceCost( char const c1, char const c2 ) const {
+        return replaceCosts_[ ( unsigned( static_cast< unsigned char >( c1 ) ) << 8 ) | static_cast< unsigned char >( c2 ) ];
+    }
+
+    /*
+     * the letter without its diacritic, 0 for other code points; covers
+     * Latin-1 and Polish letters
+     */
+
+    static char baseLetter( std::uint32_t const codePoint ){
+        static char const latin1[] = "AAAAAA-CEEEEIIII-NOOOOO-OUUUUY--aaaaaa-ceeeeiiii-nooooo-ouuuuy-y";
+
+        static std::pair< std::uint32_t, char > const polish[] = {
+            { 0x104, 'A' }, { 0x105, 'a' }, { 0x106, 'C' }, { 0x107, 'c' },
+            { 0x118, 'E' }, { 0x119, 'e' }, { 0x141, 'L' }, { 0x142, 'l' },
+            { 0x143, 'N' }, { 0x144, 'n' }, { 0x15A, 'S' }, { 0x15B, 's' },
+            { 0x179, 'Z' }, { 0x17A, 'z' }, { 0x17B, 'Z' }, { 0x17C, 'z' }
+        };
+
+        if( codePoint >= 0xC0 && codePoint <= 0xFF ){
+            char const result = latin1[ codePoint - 0xC0 ];
+            return result == '-' ? 0 : result;
+        }
+
+        for( auto const & letter : polish ){
+            if( letter.first == codePoint ){
+                return letter.second;
+            }
+        }
+
+        return 0;
+    }
+
+    /*
+     * Symbols of letters with diacritics: replacing one with its base
+     * letter or with a letter of the same base costs 1, other replaces
+     * cost one more than for the base letter, as the letter is typed with
+     * an extra key.
+     */
+
+    void addAlphabet( Alphabet const & alphabet ){
+        diacritics_.clear();
+
+        for( unsigned i = 0 ; i < Alphabet::Size ; ++ i ){
+            char const base = baseLetter( alphabet.codePoints_[ i ] );
+
+            if( base != 0 ){
+                diacritics_.emplace_back( char( Alphabet::First + i ), base );
+            }
+        }
+
+        buildReplaceCosts();
+    }
+
+    void buildReplaceCosts(){
+        replaceCosts_.assign( 256 * 256, replaceCost( -1 ) );
+
+        for( auto const & lhs : layout_ ){
+            for( auto const & rhs : layout_ ){
+                unsigned const index =
+                    ( unsigned( static_cast< unsigned char >( lhs.first ) ) << 8 ) |
+                    static_cast< unsigned char >( rhs.first );
+
+                replaceCosts_[ index ] = replaceCost( lhs.second.distance( rhs.second ) );
+            }
+        }
+
+        char base[ 256 ];
+
+        for( unsigned c = 0 ; c < 256 ; ++ c ){
+            base[ c ] = char( c );
+        }
+
+        for( auto const & letter : diacritics_ ){
+            base[ static_cast< unsigned char >( letter.first ) ] = letter.second;
+        }
+
+        std::vector< unsigned char > const keyboardCosts( replaceCosts_ );
+
+        for( auto const & letter : diacritics_ ){
+            unsigned const symbol = static_cast< unsigned char >( letter.first );
+            unsigned const symbolBase = static_cast< unsigned char >( letter.second );
+
+            for( unsigned c = 0 ; c < 256 ; ++ c ){
+                if( c == symbol ){
+                    continue;
+                }
+
+                unsigned const otherBase = static_cast< unsigned char >( base[ c ] );
+
+                unsigned char const cost = symbolBase == otherBase
+                    ? 1
+                    : std::min( 4, keyboardCosts[ ( symbolBase << 8 ) | otherBase ] + 1 );
+
+                replaceCosts_[ ( symbol << 8 ) | c ] = cost;
+                replaceCosts_[ ( c << 8 ) | symbol ] = cost;
+            }
+        }
+    }
+
+    std::map< char, Position > layout_;
+
+    /*
+     * Alphabet symbols of letters with diacritics and their base letters
+     */
+
+    std::vector< std::pair< char, char > > diacritics_;
+
+    /*
+     * replaceCosts_[ c1 * 256 + c2 ] is replaceCost( distance( c1, c2 ) )
+     * for keys and the diacritics rule for symbols in diacritics_, rebuilt
+     * by addLayout and addAlphabet
+     */
+
+    std::vector< unsigned char > replaceCosts_;
+};
+
+/*
+ * DefaultPenaltyPolicy
+ *
+ * Penalties used by the search engine. Nothing is virtual, so the engine
+ * instantiated with it inlines every penalty.
+ */
+
+struct DefaultPenaltyPolicy{
+    constexpr DefaultPenaltyPolicy( KeyboardLayout const * keyboardLayout )
+        : keyboardLayout_( keyboardLayout )
+    {
+    }
+
+    static constexpr int maxNumberOfMistakes( int const wordLength ){
+        return wordLength > 3 ? wordLength : 3;
+    }
+
+    static constexpr int swapLetter( char const, char const ){
+        return 2;
+    }
+
+    static constexpr int insertLetter( char const, char const, char const = char( 0 ) ){
+        return 3;
+    }
+
+    int replaceLetter( char const currentLetter, char const replaceLetter, char const nextLetter = char( 0 ) ) const {
+        int const cost = keyboardLayout_->replaceCost( currentLetter, replaceLetter );
+
+        if( nextLetter == char( 0 ) ){
+            return cost;
+        }
+
+        return std::min( cost, keyboardLayout_->replaceCost( replaceLetter, nextLetter ) );
+    }
+
+    static constexpr int exactMatch( char const = char( 0 ) ){
+        return 0;
+    }
+
+    static constexpr int deleteLetter( char const, char const, char const = char( 0 ) ){
+        return 3;
+    }
+
+    /*
+     * lower bounds of insertLetter and deleteLetter for any letters
+     */
+
+    static constexpr int minInsertLetter(){
+        return 3;
+    }
+
+    static constexpr int minDeleteLetter(){
+        return 3;
+    }
+
+    /*
+     * Order of suggestions, lower first, for a penalty and the quantized
+     * frequency of the word. It must not decrease with the penalty nor
+     * grow with the frequency. One point of penalty is worth 8 doublings
+     * of the frequency, without frequencies the order is by penalty.
+     */
+
+    static constexpr int rank( int const penalty, unsigned const frequency ){
+        return penalty * 32 - int( frequency );
+    }
+
+    KeyboardLayout const * keyboardLayout_;
+};
+
+/*
+ * PenaltyPolicy
+ *
+ * Base for custom penalties decided at run time. The engine can be
+ * instantiated with any type providing the same members, a PenaltyPolicy
+ * pays a virtual call per penalty.
+ */
+
+struct PenaltyPolicy{
+    PenaltyPolicy( KeyboardLayout const * keyboardLayout )
+        : keyboardLayout_( keyboardLayout )
+    
+    {
+    }
+
+    virtual ~PenaltyPolicy(){
+    }
+
+    virtual int maxNumberOfMistakes( int const wordLength ) const {
+        return DefaultPenaltyPolicy::maxNumberOfMistakes( wordLength );
+    }
+
+    virtual int swapLetter( char const currentLetter, char const nextLetter ) const {
+        return DefaultPenaltyPolicy::swapLetter( currentLetter, nextLetter );
+    }
+
+    virtual int insertLetter( char const currentLetter, char const insertedLetter, char const nextLetter = char( 0 ) ) const {
+        return DefaultPenaltyPolicy::insertLetter( currentLetter, insertedLetter, nextLetter );
+    }
+
+    virtual int replaceLetter( char const currentLetter, char const replaceLetter, char const nextLetter = char( 0 ) ) const {
+        return DefaultPenaltyPolicy( keyboardLayout_ ).replaceLetter( currentLetter, replaceLetter, nextLetter );
+    }
+
+    virtual int exactMatch( char const currentLetter = char( 0 ) ) const {
+        return DefaultPenaltyPolicy::exactMatch( currentLetter );
+    }
+
+    virtual int deleteLetter( char const previousLetter, char const currentLetter, char const nextLetter = char( 0 ) ) const {
+        return DefaultPenaltyPolicy::deleteLetter( previousLetter, currentLetter, nextLetter );
+    }
+
+    virtual int minInsertLetter() const {
+        return DefaultPenaltyPolicy::minInsertLetter();
+    }
+
+    virtual int minDeleteLetter() const {
+        return DefaultPenaltyPolicy::minDeleteLetter();
+    }
+
+    virtual int rank( int const penalty, unsigned const frequency ) const {
+        return DefaultPenaltyPolicy::rank( penalty, frequency );
+    }
+
+    KeyboardLayout const * keyboardLayout_;
+};
+
+/*
+ * Pool
+ *
+ * Owns storage of per-query objects. Slots are handed out from chunks
+ * which are never freed, so a reset is O(1) and the memory is reused
+ * by the next query.
+ */
+
+template< typename T >
+struct Pool{
+    static_assert( std::is_trivially_destructible< T >::value, "Pool< T >" );
+
+    typedef typename std::aligned_storage< sizeof( T ), alignof( T ) >::type Slot;
+
+    static unsigned const ChunkSize = 4096;
+
+    Pool()
+        : used_( 0 ){
+    }
+
+    Pool( Pool const & ) = delete;
+    Pool( Pool && ) = delete;
+
+    Pool & operator=( Pool const & ) = delete;
+    Pool & operator=( Pool && ) = delete;
+
+    template< typename ... Args >
+    T * create( Args && ... args ){
+        if( released_.empty() == false ){
+            T * const ptr = released_.back();
+            released_.pop_back();
+            return new( ptr ) T( std::forward< Args >( args ) ... );
+        }
+
+        if( used_ == chunks_.size() * ChunkSize ){
+            chunks_.emplace_back( new Slot[ ChunkSize ] );
+        }
+
+        void * const ptr = & chunks_[ used_ / ChunkSize ][ used_ % ChunkSize ];
+        used_ += 1;
+
+        return new( ptr ) T( std::forward< Args >( args ) ... );
+    }
+
+    void release( T * const t ){
+        released_.push_back( t );
+    }
+
+    void reset(){
+        used_ = 0;
+        released_.clear();
+    }
+
+    /*
+     * takes back the slots handed out after the first used ones, for a
+     * pool nothing was released to
+     */
+
+    void rollback( unsigned const used ){
+        used_ = used;
+    }
+
+    unsigned used_;
+    std::vector< std::unique_ptr< Slot[] > > chunks_;
+    std::vector< T * > released_;
+};
+
+/*
+ * PathRecord
+ *
+ * Edit operations are kept as a parent-linked list shared by all
+ * iterators spawned from the same ancestor. Words and edit traces are
+ * rebuilt only for the final candidates.
+ */
+
+struct PathRecord{
+    PathRecord(
+        PathRecord const * const parent,
+        char const operation,
+        char const first = char( 0 ),
+        char const second = char( 0 )
+    )
+        : parent_( parent )
+        , operation_( operation )
+    {
+        letters_[ 0 ] = first;
+        letters_[ 1 ] = second;
+    }
+
+    static std::string word( PathRecord const * path ){
+        std::string result;
+
+        for( ; path != nullptr ; path = path->parent_ ){
+            for( int i = 1 ; i >= 0 ; -- i ){
+                if( path->letters_[ i ] != char( 0 ) ){
+                    result.push_back( path->letters_[ i ] );
+                }
+            }
+        }
+
+        std::reverse( result.begin(), result.end() );
+        return result;
+    }
+
+    static std::string debug( PathRecord const * path ){
+        std::string result;
+
+        for( ; path != nullptr ; path = path->parent_ ){
+            result.push_back( path->operation_ );
+        }
+
+        std::reverse( result.begin(), result.end() );
+        return result;
+    }
+
+    /*
+     * letter( path, 0 ) is the last letter of the word, letter( path, 1 )
+     * the one before it, char( 0 ) if the word is too short
+     */
+
+    static char letter( PathRecord const * path, unsigned fromEnd ){
+        for( ; path != nullptr ; path = path->parent_ ){
+            for( int i = 1 ; i >= 0 ; -- i ){
+                if( path->letters_[ i ] != char( 0 ) ){
+                    if( fromEnd == 0 ){
+                        return path->letters_[ i ];
+                    }
+
+                    fromEnd -= 1;
+                }
+            }
+        }
+
+        return char( 0 );
+    }
+
+    PathRecord const * parent_;
+    char operation_;
+    char letters_[ 2 ];
+};
+
+/*
+ * TrieIterator
+ */
+
+struct SearchContext;
+
+struct TrieIterator{
+    TrieIterator(
+        FlatTrie::Index const node,
+        int const penalty,
+        PathRecord const * const path,
+        bool const skip = false
+    )
+        : node_( node )
+        , penalty_( penalty )
+        , path_( path )
+        , skip_( skip )
+        , deleted_( false )
+    {
+    }
+
+    template< typename Policy >
+    void move( SearchContext & context, Policy const & penaltyPolicy, char const c, char const nextLetter = char( 0 ) );
+    
+    int getPenalty() const {
+        return penalty_;
+    }
+
+    std::string word() const {
+        return PathRecord::word( path_ );
+    }
+
+    std::string debug() const {
+        return PathRecord::debug( path_ );
+    }
+
+    FlatTrie::Index node_;
+    int penalty_;
+    PathRecord const * path_;
+
+    /*
+     * set after a swap, the next letter is already consumed
+     */
+
+    bool skip_;
+
+    /*
+     * set when move deleted a letter, the 'D' record is added to path_
+     * only if the iterator survives pruning
+     */
+
+    bool deleted_;
+};
+
+/*
+ * Suggestion
+ */
+
+struct Suggestion{
+    std::string word_;
+    int penalty_;
+
+    /*
+     * quantized frequency of the word, 0 if the dictionary has none
+     */
+
+    unsigned frequency_;
+};
+
+bool operator==( Suggestion const & lhs, Suggestion const & rhs ){
+    return lhs.word_ == rhs.word_ && lhs.penalty_ == rhs.penalty_;
+}
+
+bool operator<( Suggestion const & lhs, Suggestion const & rhs ){
+    if( lhs.penalty_ != rhs.penalty_ ){
+        return lhs.penalty_ < rhs.penalty_;
+    }
+
+    return lhs.word_ < rhs.word_;
+}
+
+/*
+ * BitParallelDistance
+ *
+ * Restricted Damerau-Levenshtein distance ( one swap of adjacent letters
+ * costs 1 ) between a word of at most 64 letters and a prefix growing
+ * letter by letter, in Hyyro's bit-parallel form of Myers' algorithm.
+ * A column describes the distances from the prefix to all prefixes of
+ * the word: bit i of positive_ ( negative_ ) is set when the distance to
+ * the first i + 1 letters is one more ( less ) than to the first i.
+ */
+
+struct BitParallelDistance{
+    static unsigned const MaxSize = 64;
+
+    struct Column{
+        std::uint64_t positive_;
+        std::uint64_t negative_;
+        std::uint64_t diagonal_;
+        std::uint64_t match_;
+        unsigned length_;
+        unsigned distance_;
+    };
+
+    BitParallelDistance( std::string const & word )
+        : size_( word.size() )
+        , mask_( word.size() == MaxSize ? ~ std::uint64_t( 0 ) : ( std::uint64_t( 1 ) << word.size() ) - 1 )
+    {
+        if( word.size() > MaxSize ){
+            throw std::runtime_error( "BitParallelDistance: word too long: " + word );
+        }
+
+        std::fill( match_, match_ + 256, 0 );
+
+        for( unsigned i = 0 ; i < word.size() ; ++ i ){
+            match_[ static_cast< unsigned char >( word[ i ] ) ] |= std::uint64_t( 1 ) << i;
+        }
+    }
+
+    Column first() const {
+        return Column{ mask_, 0, 0, 0, 0, size_ };
+    }
+
+    Column next( Column const & column, char const c ) const {
+        std::uint64_t const match = match_[ static_cast< unsigned char >( c ) ];
+        std::uint64_t const positive = column.positive_;
+        std::uint64_t const negative = column.negative_;
+
+        std::uint64_t const swap = ( ( ~ column.diagonal_ & match ) << 1 ) & column.match_;
+        std::uint64_t const diagonal = ( swap | ( ( ( match & positive ) + positive ) ^ positive ) | match | negative ) & mask_;
+
+        std::uint64_t horizontalPositive = negative | ~ ( diagonal | positive );
+        std::uint64_t horizontalNegative = positive & diagonal;
+
+        unsigned distance = column.distance_;
+
+        if( size_ == 0 ){
+            distance += 1;
+        }
+        else{
+            std::uint64_t const last = std::uint64_t( 1 ) << ( size_ - 1 );
+            distance += ( horizontalPositive & last ) != 0;
+            distance -= ( horizontalNegative & last ) != 0;
+        }
+
+        horizontalPositive = ( horizontalPositive << 1 ) | 1;
+        horizontalNegative = horizontalNegative << 1;
+
+        return Column{
+            ( horizontalNegative | ~ ( diagonal | horizontalPositive ) ) & mask_,
+            horizontalPositive & diagonal & mask_,
+            diagonal,
+            match,
+            column.length_ + 1,
+            distance
+        };
+    }
+
+    /*
+     * false if no extension of the prefix can be within limit of the word,
+     * only prefixes of the word at most limit letters longer or shorter
+     * than the prefix need to be checked
+     */
+
+    bool reachable( Column const & column, unsigned const limit ) const {
+        unsigned const first = column.length_ > limit ? column.length_ - limit : 0;
+        unsigned const last = std::min( size_, column.length_ + limit );
+
+        if( first > last ){
+            return false;
+        }
+
+        std::uint64_t const below = first == MaxSize ? ~ std::uint64_t( 0 ) : ( std::uint64_t( 1 ) << first ) - 1;
+        unsigned distance = column.length_
+            + std::bitset< MaxSize >( column.positive_ & below ).count()
+            - std::bitset< MaxSize >( column.negative_ & below ).count();
+
+        for( unsigned i = first ; ; ++ i ){
+            if( distance <= limit ){
+                return true;
+            }
+
+            if( i == last ){
+                return false;
+            }
+
+            distance += ( column.positive_ >> i ) & 1;
+            distance -= ( column.negative_ >> i ) & 1;
+        }
+    }
+
+    unsigned distance( std::string const & other ) const {
+        Column column = first();
+
+        for( char const c : other ){
+            column = next( column, c );
+        }
+
+        return column.distance_;
+    }
+
+    unsigned size_;
+    std::uint64_t mask_;
+    std::uint64_t match_[ 256 ];
+};
+
+unsigned const BitParallelDistance::MaxSize;
+
+/*
+ * SymSpellIndex
+ *
+ * Symmetric delete index of all words of a trie: every variant of the
+ * first PrefixLength letters of a word with up to MaxDistance letters
+ * deleted is stored as a 32 bit hash next to the word number. Entries are
+ * sorted by hash and bucketed by its top bits. Two words within distance
+ * d share a variant with at most d deletes on each side, so a query looks
+ * up its own variants and gets a superset of the words within d.
+ */
+
+struct SymSpellIndex{
+    static unsigned const MaxDistance = 2;
+    static unsigned const PrefixLength = 7;
+    static unsigned const BucketBits = 20;
+
+    SymSpellIndex( FlatTrie const & trie ){
+        collectWords( trie );
+        offsets_.push_back( letters_.size() );
+
+        std::vector< std::pair< std::uint32_t, std::uint32_t > > entries;
+        std::vector< std::uint32_t > variants;
+
+        for( std::uint32_t id = 0 ; id + 1 < offsets_.size() ; ++ id ){
+            variants.clear();
+            addVariants( this->word( id ).substr( 0, PrefixLength ), 0, MaxDistance, variants );
+
+            std::sort( variants.begin(), variants.end() );
+            variants.erase( std::unique( variants.begin(), variants.end() ), variants.end() );
+
+            for( std::uint32_t const hash : variants ){
+                entries.emplace_back( hash, id );
+            }
+        }
+
+        std::sort( entries.begin(), entries.end() );
+
+        hashes_.reserve( entries.size() );
+        ids_.reserve( entries.size() );
+        buckets_.assign( ( 1u << BucketBits ) + 1, 0 );
+
+        for( auto const & entry : entries ){
+            hashes_.push_back( entry.first );
+            ids_.push_back( entry.second );
+            buckets_[ bucket( entry.first ) + 1 ] += 1;
+        }
+
+        for( unsigned i = 1 ; i < buckets_.size() ; ++ i ){
+            buckets_[ i ] += buckets_[ i - 1 ];
+        }
+    }
+
+    /*
+     * words in order of their letters, depth first with an explicit stack
+     * of the next child to visit on every level
+     */
+
+    void collectWords( FlatTrie const & trie ){
+        std::string word;
+        std::vector< FlatTrie::Index > next( 1, trie.begin( FlatTrie::Root ) );
+        std::vector< FlatTrie::Index > last( 1, trie.end( FlatTrie::Root ) );
+
+        if( trie.isEnd( FlatTrie::Root ) ){
+            offsets_.push_back( letters_.size() );
+        }
+
+        while( next.empty() == false ){
+            if( next.back() == last.back() ){
+                next.pop_back();
+                last.pop_back();
+
+                if( word.empty() == false ){
+                    word.pop_back();
+                }
+
+                continue;
+            }
+
+            FlatTrie::Index const child = next.back() ++;
+            word.push_back( trie.letter( child ) );
+
+            if( trie.isEnd( child ) ){
+                offsets_.push_back( letters_.size() );
+                letters_.append( word );
+            }
+
+            next.push_back( trie.begin( child ) );
+            last.push_back( trie.end( child ) );
+        }
+    }
+
+    static std::uint32_t hash( std::string const & variant ){
+        std::uint32_t result = 2166136261u;
+
+        for( char const c : variant ){
+            result = ( result ^ static_cast< unsigned char >( c ) ) * 16777619u;
+        }
+
+        return result;
+    }
+
+    static unsigned bucket( std::uint32_t const hash ){
+        return hash >> ( 32 - BucketBits );
+    }
+
+    /*
+     * variants of prefix with up to distance letters deleted, each deleted
+     * position not before from, so every set of positions comes once
+     */
+
+    static void addVariants( std::string const & prefix, unsigned const from, unsigned const distance, std::vector< std::uint32_t > & result ){
+        result.push_back( hash( prefix ) );
+
+        if( distance == 0 ){
+            return;
+        }
+
+        for( unsigned i = from ; i < prefix.size() ; ++ i ){
+            addVariants( prefix.substr( 0, i ) + prefix.substr( i + 1 ), i, distance - 1, result );
+        }
+    }
+
+    /*
+     * numbers of words which may be within distance of word, sorted
+     */
+
+    std::vector< std::uint32_t > candidates( std::string const & word, unsigned const distance ) const {
+        if( distance > MaxDistance ){
+            throw std::runtime_error( "SymSpellIndex: distance over " + std::to_string( MaxDistance ) );
+        }
+
+        std::vector< std::uint32_t > variants;
+        addVariants( word.substr( 0, PrefixLength ), 0, distance, variants );
+
+        std::sort( variants.begin(), variants.end() );
+        variants.erase( std::unique( variants.begin(), variants.end() ), variants.end() );
+
+        std::vector< std::uint32_t > result;
+
+        for( std::uint32_t const hash : variants ){
+            for( std::uint32_t i = buckets_[ bucket( hash ) ], end = buckets_[ bucket( hash ) + 1 ] ; i != end ; ++ i ){
+                if( hashes_[ i ] == hash ){
+                    result.push_back( ids_[ i ] );
+                }
+            }
+        }
+
+        std::sort( result.begin(), result.end() );
+        result.erase( std::unique( result.begin(), result.end() ), result.end() );
+
+        return result;
+    }
+
+    std::string word( std::uint32_t const id ) const {
+        return letters_.substr( offsets_[ id ], offsets_[ id + 1 ] - offsets_[ id ] );
+    }
+
+    std::size_t size() const {
+        return offsets_.size() - 1;
+    }
+
+    std::size_t bytes() const {
+        return letters_.capacity()
+            + offsets_.capacity() * sizeof( std::uint32_t )
+            + hashes_.capacity() * sizeof( std::uint32_t )
+            + ids_.capacity() * sizeof( std::uint32_t )
+            + buckets_.capacity() * sizeof( std::uint32_t );
+    }
+
+    std::string letters_;
+    std::vector< std::uint32_t > offsets_;
+    std::vector< std::uint32_t > hashes_;
+    std::vector< std::uint32_t > ids_;
+    std::vector< std::uint32_t > buckets_;
+};
+
+unsigned const SymSpellIndex::MaxDistance;
+
+/*
+ * SearchOptions
+ */
+
+struct SearchOptions{
+    /*
+     * keep only the cheapest iterator per ( node, skip ) after each letter,
+     * the set of suggestions and their penalties stays the same but the
+     * order of suggestions with equal penalties may differ
+     *
+     * ignored for a minimized trie, where a node does not determine the word
+     */
+
+    bool deduplicate_ = false;
+
+    /*
+     * frontiers of at least parallelThreshold_ iterators are expanded by
+     * parallelThreads_ workers ( 0 means one per core ), each into its own
+     * buffer; buffers are merged in order so results do not change,
+     * 0 turns it off
+     */
+
+    unsigned parallelThreshold_ = 0;
+    unsigned parallelThreads_ = 0;
+
+    /*
+     * a word found in the dictionary is returned as the only suggestion,
+     * without running the fuzzy search
+     */
+
+    bool acceptKnownWords_ = false;
+
+    /*
+     * Lockstep advances all iterators one letter at a time, BestFirst
+     * expands ( node, position ) states cheapest first, guided by a lower
+     * bound of the remaining penalty. It finds the same suggestions with
+     * the same penalties, but words of equal penalty may come in another
+     * order, so with a limit the words kept at the cut may differ too
+     *
+     * BestFirst falls back to Lockstep for a minimized trie and for words
+     * longer than 63 letters
+     *
+     * BitParallel walks the trie depth first keeping only words within
+     * maxDistance_ plain edits ( swaps included ) of the input, then ranks
+     * them by penalty; the result is the part of the Lockstep result within
+     * that distance. Words longer than 64 letters use Lockstep.
+     *
+     * SymSpell looks the word up in a SymSpellIndex, built on first use,
+     * and returns the same suggestions as BitParallel; maxDistance_ must
+     * not exceed SymSpellIndex::MaxDistance
+     */
+
+    enum Engine{
+        Lockstep,
+        BestFirst,
+        BitParallel,
+        SymSpell
+    };
+
+    Engine engine_ = Lockstep;
+    unsigned maxDistance_ = 1;
+};
+
+/*
+ * CacheStats
+ *
+ * Counters of a ResultCache since it was made, its entries and bytes as
+ * they are now.
+ */
+
+struct CacheStats{
+    void print( std::ostream & output ) const {
+        output
+            << "{\"hits\":" << hits_
+            << ",\"knownHits\":" << knownHits_
+            << ",\"misses\":" << misses_
+            << ",\"evictions\":" << evictions_
+            << ",\"entries\":" << entries_
+            << ",\"bytes\":" << bytes_
+            << "}";
+    }
+
+    std::uint64_t hits_ = 0;
+
+    /*
+     * hits on known entries, included in hits_
+     */
+
+    std::uint64_t knownHits_ = 0;
+    std::uint64_t misses_ = 0;
+    std::uint64_t evictions_ = 0;
+    std::size_t entries_ = 0;
+    std::size_t bytes_ = 0;
+};
+
+/*
+ * QueryStats
+ *
+ * Counters of the last lockstep query of a SearchContext, collected only
+ * when built with SPELLCHECKER_STATS ( make STATS=1 ). Times are in
+ * nanoseconds. A query answered from the result cache counts nothing
+ * but cached_; SpellChecker::stats() adds the counters of the cache.
+ */
+
+struct QueryStats{
+    static char const * operations(){
+        return "ERIDS";
+    }
+
+    void clear(){
+        * this = QueryStats();
+    }
+
+    void created( char const operation ){
+        for( unsigned i = 0 ; i < 5 ; ++ i ){
+            if( operations()[ i ] == operation ){
+                created_[ i ] += 1;
+            }
+        }
+    }
+
+    void pruned( std::size_t const count ){
+        if( pruned_.empty() == false ){
+            pruned_.back() += count;
+        }
+    }
+
+    /*
+     * adds what a parallel worker counted
+     */
+
+    void merge( QueryStats const & other ){
+        for( unsigned i = 0 ; i < 5 ; ++ i ){
+            created_[ i ] += other.created_[ i ];
+        }
+
+        nodesVisited_ += other.nodesVisited_;
+    }
+
+    void print( std::ostream & output ) const {
+        output << "{\"created\":{";
+
+        for( unsigned i = 0 ; i < 5 ; ++ i ){
+            output << ( i == 0 ? "" : "," ) << "\"" << operations()[ i ] << "\":" << created_[ i ];
+        }
+
+        output << "},\"pruned\":[";
+
+        for( unsigned i = 0 ; i < pruned_.size() ; ++ i ){
+            output << ( i == 0 ? "" : "," ) << pruned_[ i ];
+        }
+
+        output
+            << "],\"peakFrontier\":" << peakFrontier_
+            << ",\"nodesVisited\":" << nodesVisited_
+            << ",\"time\":{"
+            << "\"expand\":" << expandTime_
+            << ",\"prune\":" << pruneTime_
+            << ",\"collect\":" << collectTime_
+            << "},\"cached\":" << ( cached_ ? "true" : "false" )
+            << ",\"cache\":";
+
+        cache_.print( output );
+        output << "}";
+    }
+
+    /*
+     * iterators created by each operation of operations(), a delete
+     * moves the iterator itself
+     */
+
+    std::uint64_t created_[ 5 ] = { 0, 0, 0, 0, 0 };
+
+    /*
+     * iterators dropped after each letter, deduplicated ones included
+     */
+
+    std::vector< std::uint64_t > pruned_;
+
+    std::size_t peakFrontier_ = 0;
+
+    /*
+     * child entries read by TrieIterator::move, or by the BestFirst and
+     * BitParallel engines
+     */
+
+    std::uint64_t nodesVisited_ = 0;
+
+    double expandTime_ = 0;
+    double pruneTime_ = 0;
+    double collectTime_ = 0;
+
+    bool cached_ = false;
+    CacheStats cache_;
+};
+
+/*
+ * ThreadPool
+ *
+ * run() executes a task on every worker thread and waits for all of them,
+ * the task gets the index of its worker.
+ */
+
+struct ThreadPool{
+    typedef std::function< void( unsigned ) > Task;
+
+    ThreadPool( unsigned const threads )
+        : task_( nullptr )
+        , pending_( 0 )
+        , generation_( 0 )
+        , stop_( false )
+    {
+        for( unsigned i = 0 ; i < std::max( 1u, threads ) ; ++ i ){
+            threads_.emplace_back( & ThreadPool::work, this, i );
+        }
+    }
+
+    ThreadPool( ThreadPool const & ) = delete;
+    ThreadPool( ThreadPool && ) = delete;
+
+    ~ThreadPool(){
+        {
+            std::lock_guard< std::mutex > lock( mutex_ );
+            stop_ = true;
+        }
+
+        wake_.notify_all();
+
+        for( std::thread & thread : threads_ ){
+            thread.join();
+        }
+    }
+
+    ThreadPool & operator=( ThreadPool const & ) = delete;
+    ThreadPool & operator=( ThreadPool && ) = delete;
+
+    void run( Task const & task ){
+        std::unique_lock< std::mutex > lock( mutex_ );
+
+        task_ = & task;
+        error_ = nullptr;
+        pending_ = threads_.size();
+        generation_ += 1;
+
+        wake_.notify_all();
+        done_.wait( lock, [ this ](){ return pending_ == 0; } );
+
+        task_ = nullptr;
+
+        if( error_ ){
+            std::rethrow_exception( error_ );
+        }
+    }
+
+    unsigned size() const {
+        return threads_.size();
+    }
+
+    void work( unsigned const index ){
+        unsigned generation = 0;
+
+        while( true ){
+            Task const * task = nullptr;
+
+            {
+                std::unique_lock< std::mutex > lock( mutex_ );
+                wake_.wait( lock, [ this, generation ](){ return stop_ || generation_ != generation; } );
+
+                if( stop_ ){
+                    return;
+                }
+
+                generation = generation_;
+                task = task_;
+            }
+
+            std::exception_ptr error;
+
+            try{
+                ( * task )( index );
+            }
+            catch( ... ){
+                error = std::current_exception();
+            }
+
+            {
+                std::lock_guard< std::mutex > lock( mutex_ );
+
+                if( error ){
+                    error_ = error;
+                }
+
+                if( -- pending_ == 0 ){
+                    done_.notify_one();
+                }
+            }
+        }
+    }
+
+    std::vector< std::thread > threads_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    Task const * task_;
+    std::exception_ptr error_;
+    unsigned pending_;
+    unsigned generation_;
+    bool stop_;
+};
+
+/*
+ * WordList
+ *
+ * Words of a dictionary file read in one pass, as Alphabet symbols one
+ * after another, with the quantized frequency of each word.
+ */
+
+struct WordList{
+    WordList( char const * const begin, char const * const end ){
+        offsets_.push_back( 0 );
+
+        for( char const * line = begin ; line < end ; ){
+            char const * lineEnd = static_cast< char const * >( std::memchr( line, '\n', end - line ) );
+
+            if( lineEnd == nullptr ){
+                lineEnd = end;
+            }
+
+            char const * const wordEnd = line + splitFrequency( line, lineEnd );
+
+            if( wordEnd != line ){
+                for( char const * letter = line ; letter != wordEnd ; ){
+                    if( static_cast< unsigned char >( * letter ) < 0x80 ){
+                        symbols_.push_back( * letter ++ );
+                    }
+                    else{
+                        symbols_.push_back( char( alphabet_.add( Alphabet::readUtf8( letter, wordEnd ) ) ) );
+                    }
+                }
+
+                std::uint64_t frequency = 0;
+
+                for( char const * digit = wordEnd + ( wordEnd != lineEnd ) ; digit < lineEnd ; ++ digit ){
+                    frequency = frequency > ( std::uint64_t( -1 ) - 9 ) / 10 ? std::uint64_t( -1 ) : frequency * 10 + ( * digit - '0' );
+                }
+
+                offsets_.push_back( symbols_.size() );
+                frequencies_.push_back( FlatTrie::quantize( frequency ) );
+            }
+
+            line = lineEnd + 1;
+        }
+    }
+
+    /*
+     * length of the word in a line, the frequency follows it if shorter
+     */
+
+    static std::size_t splitFrequency( char const * const begin, char const * const end ){
+        char const * separator = end;
+
+        while( separator != begin && separator[ -1 ] != ' ' && separator[ -1 ] != '\t' ){
+            -- separator;
+        }
+
+        if( separator == begin || separator == begin + 1 || separator == end ){
+            return end - begin;
+        }
+
+        for( char const * digit = separator ; digit != end ; ++ digit ){
+            if( std::isdigit( static_cast< unsigned char >( * digit ) ) == 0 ){
+                return end - begin;
+            }
+        }
+
+        return separator - 1 - begin;
+    }
+
+    std::uint32_t size() const {
+        return frequencies_.size();
+    }
+
+    char const * begin( std::uint32_t const word ) const {
+        return symbols_.data() + offsets_[ word ];
+    }
+
+    char const * end( std::uint32_t const word ) const {
+        return symbols_.data() + offsets_[ word + 1 ];
+    }
+
+    bool frequencies() const {
+        return std::any_of( frequencies_.begin(), frequencies_.end(), []( unsigned char const f ){ return f != 0; } );
+    }
+
+    std::string symbols_;
+    std::vector< std::uint32_t > offsets_;
+    std::vector< unsigned char > frequencies_;
+    Alphabet alphabet_;
+};
+
+/*
+ * SubtrieBuilder
+ *
+ * Trie of the words starting with one letter, its nodes in one vector.
+ * Children are a linked list in order of insertion, and a word only
+ * walks down from where it leaves the previous one, so a sorted list
+ * looks up each node once.
+ */
+
+struct SubtrieBuilder{
+    typedef std::uint32_t Index;
+
+    static Index const None = Index( -1 );
+
+    struct Node{
+        Index firstChild_;
+        Index lastChild_;
+        Index nextSibling_;
+        char letter_;
+        unsigned char ends_;
+        std::uint16_t children_;
+    };
+
+    SubtrieBuilder( char const letter )
+        : nodes_( 1, Node{ None, None, None, letter, 0, 0 } )
+        , path_( 1, 0 )
+    {
+    }
+
+    /*
+     * adds a word without its first letter
+     */
+
+    void insert( char const * const begin, char const * const end, unsigned char const frequency ){
+        std::size_t const size = end - begin;
+        std::size_t common = 0;
+
+        while( common < size && common < previous_.size() && begin[ common ] == previous_[ common ] ){
+            ++ common;
+        }
+
+        path_.resize( common + 1 );
+
+        Index node = path_.back();
+
+        for( std::size_t i = common ; i < size ; ++ i ){
+            node = getOrCreate( node, begin[ i ] );
+            path_.push_back( node );
+        }
+
+        previous_.assign( begin, end );
+
+        unsigned char const current = nodes_[ node ].ends_ >> 1;
+        nodes_[ node ].ends_ = ( std::max( current, frequency ) << 1 ) | FlatTrie::EndFlag;
+    }
+
+    Index getOrCreate( Index const node, char const c ){
+        for( Index child = nodes_[ node ].firstChild_ ; child != None ; child = nodes_[ child ].nextSibling_ ){
+            if( nodes_[ child ].letter_ == c ){
+                return child;
+            }
+        }
+
+        if( nodes_[ node ].children_ == 255 ){
+            throw std::runtime_error( "Dictionary: more than 255 letters follow one prefix" );
+        }
+
+        Index const result = nodes_.size();
+        nodes_.push_back( Node{ None, None, None, c, 0, 0 } );
+
+        Node & parent = nodes_[ node ];
+
+        if( parent.lastChild_ == None ){
+            parent.firstChild_ = result;
+        }
+        else{
+            nodes_[ parent.lastChild_ ].nextSibling_ = result;
+        }
+
+        parent.lastChild_ = result;
+        parent.children_ += 1;
+
+        return result;
+    }
+
+    /*
+     * nodes level by level in breadth first order, and the position of
+     * the first child of each node in the next level
+     */
+
+    void levels(){
+        firstInLevel_.assign( nodes_.size(), 0 );
+        levels_.assign( 1, std::vector< Index >( 1, 0 ) );
+
+        while( true ){
+            std::vector< Index > next;
+
+            for( Index const node : levels_.back() ){
+                firstInLevel_[ node ] = next.size();
+
+                for( Index child = nodes_[ node ].firstChild_ ; child != None ; child = nodes_[ child ].nextSibling_ ){
+                    next.push_back( child );
+                }
+            }
+
+            if( next.empty() ){
+                break;
+            }
+
+            levels_.push_back( std::move( next ) );
+        }
+    }
+
+    std::vector< Node > nodes_;
+    std::vector< Index > path_;
+    std::string previous_;
+    std::vector< std::vector< Index > > levels_;
+    std::vector< Index > firstInLevel_;
+};
+
+SubtrieBuilder::Index const SubtrieBuilder::None;
+
+/*
+ * Completion
+ *
+ * A word of a subtree, as the letters below the root of the subtree.
+ */
+
+struct Completion{
+    std::string suffix_;
+    unsigned frequency_;
+};
+
+/*
+ * Dictionary
+ *
+ * Immutable after construction, shared by all search contexts.
+ */
+
+struct Dictionary{
+    Dictionary( std::string const & fileName ){
+        if( FlatTrie::isCompiled( fileName ) ){
+            setTrie( FlatTrie::map( fileName ) );
+        }
+        else{
+            readDictFile( fileName );
+        }
+
+        std::istringstream iss1( polishKeyboardLayout );
+        keyboardLayout_.addLayout( 1, iss1 );
+
+        std::istringstream iss2( polishKeyboardShiftLayout );
+        keyboardLayout_.addLayout( 0, iss2 );
+
+        keyboardLayout_.addAlphabet( trie_.alphabet_ );
+
+        if( Debug ){
+            TrieStats( trie_ ).print( std::cout );
+        }
+    }
+
+    Dictionary( Dictionary const & ) = delete;
+    Dictionary( Dictionary && ) = delete;
+
+    Dictionary & operator=( Dictionary const & ) = delete;
+    Dictionary & operator=( Dictionary && ) = delete;
+
+    /*
+     * One word per line, optionally followed by a space or a tab and the
+     * frequency of the word
+     */
+
+    void readDictFile( std::string const & fileName, unsigned const threads = 0 ){
+        MappedFile const file( fileName );
+        WordList const words( file.data_, file.data_ + file.size_ );
+
+        setTrie( build( words, threads ) );
+    }
+
+    /*
+     * The trie of words, the same image FlatTrie::compile makes of the
+     * words inserted into Node one by one. Words are partitioned by their
+     * first letter, in order of its first appearance. Each part becomes a
+     * subtrie of its own, built on threads workers ( 0 means one per
+     * core ). A level of the compiled trie is the same level of every
+     * subtrie one after another, so each subtrie is copied in place once
+     * the sizes of all levels are known.
+     */
+
+    static FlatTrie build( WordList const & words, unsigned threads = 0 ){
+        std::vector< int > partOf( 256, -1 );
+        std::vector< std::vector< std::uint32_t > > parts;
+
+        for( std::uint32_t i = 0 ; i < words.size() ; ++ i ){
+            unsigned const first = static_cast< unsigned char >( * words.begin( i ) );
+
+            if( partOf[ first ] == -1 ){
+                partOf[ first ] = parts.size();
+                parts.emplace_back();
+            }
+
+            parts[ partOf[ first ] ].push_back( i );
+        }
+
+        if( parts.size() > 255 ){
+            throw std::runtime_error( "Dictionary: more than 255 letters follow one prefix" );
+        }
+
+        std::vector< std::unique_ptr< SubtrieBuilder > > builders( parts.size() );
+
+        auto const buildPart = [ & words, & parts, & builders ]( unsigned const part ){
+            std::vector< std::uint32_t > const & members = parts[ part ];
+
+            builders[ part ].reset( new SubtrieBuilder( * words.begin( members[ 0 ] ) ) );
+
+            for( std::uint32_t const i : members ){
+                builders[ part ]->insert( words.begin( i ) + 1, words.end( i ), words.frequencies_[ i ] );
+            }
+
+            builders[ part ]->levels();
+        };
+
+        if( threads == 0 ){
+            threads = std::max( 1u, std::thread::hardware_concurrency() );
+        }
+
+        threads = std::min< unsigned >( threads, parts.size() );
+
+        if( threads > 1 ){
+            std::atomic< unsigned > next( 0 );
+            ThreadPool pool( threads );
+
+            pool.run( [ & next, & parts, & buildPart ]( unsigned ){
+                for( unsigned part = next ++ ; part < parts.size() ; part = next ++ ){
+                    buildPart( part );
+                }
+            } );
+        }
+        else{
+            for( unsigned part = 0 ; part < parts.size() ; ++ part ){
+                buildPart( part );
+            }
+        }
+
+        /*
+         * start[ level ][ part ] is the index of the first node of part at
+         * level, level 0 of a subtrie is level 1 of the trie
+         */
+
+        std::size_t levels = 0;
+
+        for( auto const & builder : builders ){
+            levels = std::max( levels, builder->levels_.size() );
+        }
+
+        std::vector< std::vector< FlatTrie::Index > > start( levels + 1, std::vector< FlatTrie::Index >( parts.size() ) );
+        std::uint64_t size = 1;
+
+        for( std::size_t level = 0 ; level <= levels ; ++ level ){
+            for( unsigned part = 0 ; part < parts.size() ; ++ part ){
+                start[ level ][ part ] = FlatTrie::Index( size );
+
+                if( level < builders[ part ]->levels_.size() ){
+                    size += builders[ part ]->levels_[ level ].size();
+                }
+            }
+        }
+
+        if( size >= FlatTrie::None ){
+            throw std::runtime_error( "Dictionary: too many nodes" );
+        }
+
+        FlatTrie::Writer writer( size, words.frequencies() ? FlatTrie::Frequencies : 0, words.alphabet_ );
+
+        writer.letters_[ FlatTrie::Root ] = 0;
+        writer.ends_[ FlatTrie::Root ] = 0;
+        writer.first_[ FlatTrie::Root ] = 1;
+        writer.count_[ FlatTrie::Root ] = parts.size();
+
+        auto const copyPart = [ & builders, & start, & writer ]( unsigned const part ){
+            SubtrieBuilder const & builder = * builders[ part ];
+
+            for( std::size_t level = 0 ; level < builder.levels_.size() ; ++ level ){
+                FlatTrie::Index index = start[ level ][ part ];
+
+                for( SubtrieBuilder::Index const node : builder.levels_[ level ] ){
+                    SubtrieBuilder::Node const & n = builder.nodes_[ node ];
+
+                    writer.letters_[ index ] = n.letter_;
+                    writer.ends_[ index ] = n.ends_;
+                    writer.first_[ index ] = start[ level + 1 ][ part ] + builder.firstInLevel_[ node ];
+                    writer.count_[ index ] = n.children_;
+
+                    index += 1;
+                }
+            }
+        };
+
+        if( threads > 1 ){
+            std::atomic< unsigned > next( 0 );
+            ThreadPool pool( threads );
+
+            pool.run( [ & next, & parts, & copyPart ]( unsigned ){
+                for( unsigned part = next ++ ; part < parts.size() ; part = next ++ ){
+                    copyPart( part );
+                }
+            } );
+        }
+        else{
+            for( unsigned part = 0 ; part < parts.size() ; ++ part ){
+                copyPart( part );
+            }
+        }
+
+        return writer.finish();
+    }
+
+    /*
+     * the trie built word by word through Node, kept as the reference
+     * for build
+     */
+
+    static FlatTrie readByNodes( std::string const & fileName ){
+        std::ifstream file( fileName.c_str() );
+        
+        if( ! file ){
+            throw std::runtime_error( "Can't open file: " + fileName );
+        }
+
+        std::string line;
+        Node * const root = new Node;
+        Alphabet alphabet;
+        
+        while( std::getline( file, line ) ){
+            Node * node = root;
+            std::size_t const length = splitFrequency( line );
+
+            for( char const * begin = line.data(), * const end = begin + length ; begin != end ; ){
+                node = getOrCreate( node, char( alphabet.add( Alphabet::readUtf8( begin, end ) ) ) );
+
+                if( begin == end ){
+                    node->end_ = true;
+
+                    if( length != line.size() ){
+                        std::uint64_t const frequency = std::strtoull( line.c_str() + length + 1, nullptr, 10 );
+                        node->frequency_ = std::max( node->frequency_, FlatTrie::quantize( frequency ) );
+                    }
+                }
+            }
+        }
+
+        FlatTrie result = FlatTrie::compile( root, alphabet );
+        root->free();
+
+        return result;
+    }
+
+    static std::size_t splitFrequency( std::string const & line ){
+        return WordList::splitFrequency( line.data(), line.data() + line.size() );
+    }
+
+    bool contains( std::string const & word ) const {
+        std::string const symbols = trie_.alphabet_.encode( word );
+        return trie_.contains( symbols.data(), symbols.data() + symbols.size() );
+    }
+
+    FlatTrie const & trie() const {
+        return trie_;
+    }
+
+    /*
+     * replaces the trie and drops what was built from the old one, no
+     * query may run meanwhile
+     */
+
+    void setTrie( FlatTrie trie ){
+        trie_ = std::move( trie );
+        lazy_.reset( new Lazy() );
+    }
+
+    /*
+     * built on first use
+     */
+
+    TrieDepths const & depths() const {
+        std::call_once( lazy_->depthsOnce_, [ this ](){ lazy_->depths_.reset( new TrieDepths( trie_ ) ); } );
+        return * lazy_->depths_;
+    }
+
+    /*
+     * the highest frequency of a word in the subtree of node
+     */
+
+    unsigned maxFrequency( FlatTrie::Index const node ) const {
+        if( trie_.frequencies() == false ){
+            return 0;
+        }
+
+        return depths().maxFrequency_[ node ];
+    }
+
+    SymSpellIndex const & symSpellIndex() const {
+        std::call_once( lazy_->symSpellIndexOnce_, [ this ](){ lazy_->symSpellIndex_.reset( new SymSpellIndex( trie_ ) ); } );
+        return * lazy_->symSpellIndex_;
+    }
+
+    static unsigned const CompletionCacheDepth = 3;
+    static unsigned const CompletionCacheSize = 8;
+
+    /*
+     * The best limit words of the subtree of node: the most frequent
+     * first, then the shortest, then in order of their letters. Subtrees
+     * are expanded best first, bounded by their highest frequency.
+     */
+
+    std::vector< Completion > completions( FlatTrie::Index const node, unsigned const limit ) const {
+        struct Entry{
+            unsigned frequency_;
+            std::string suffix_;
+            FlatTrie::Index node_;
+            bool word_;
+
+            bool operator<( Entry const & other ) const {
+                if( frequency_ != other.frequency_ ){
+                    return frequency_ < other.frequency_;
+                }
+
+                if( suffix_.size() != other.suffix_.size() ){
+                    return suffix_.size() > other.suffix_.size();
+                }
+
+                if( suffix_ != other.suffix_ ){
+                    return suffix_ > other.suffix_;
+                }
+
+                return word_ < other.word_;
+            }
+        };
+
+        std::vector< Completion > result;
+        std::vector< Entry > queue( 1, Entry{ maxFrequency( node ), std::string(), node, false } );
+
+        while( queue.empty() == false && result.size() < limit ){
+            std::pop_heap( queue.begin(), queue.end() );
+            Entry entry = std::move( queue.back() );
+            queue.pop_back();
+
+            if( entry.word_ ){
+                result.push_back( Completion{ std::move( entry.suffix_ ), entry.frequency_ } );
+                continue;
+            }
+
+            if( trie_.isEnd( entry.node_ ) ){
+                queue.push_back( Entry{ trie_.frequency( entry.node_ ), entry.suffix_, entry.node_, true } );
+                std::push_heap( queue.begin(), queue.end() );
+            }
+
+            for( FlatTrie::Index child = trie_.begin( entry.node_ ) ; child != trie_.end( entry.node_ ) ; ++ child ){
+                queue.push_back( Entry{ maxFrequency( child ), entry.suffix_ + trie_.letter( child ), child, false } );
+                std::push_heap( queue.begin(), queue.end() );
+            }
+        }
+
+        return result;
+    }
+
+    /*
+     * completions( node, CompletionCacheSize ) of nodes at most
+     * CompletionCacheDepth letters deep, built on first use
+     */
+
+    std::unordered_map< FlatTrie::Index, std::vector< Completion > > const & completionCache() const {
+        std::call_once( lazy_->completionCacheOnce_, [ this ](){
+            std::vector< FlatTrie::Index > level( 1, FlatTrie::Root );
+
+            for( unsigned depth = 0 ; depth <= CompletionCacheDepth ; ++ depth ){
+                std::vector< FlatTrie::Index > next;
+
+                for( FlatTrie::Index const node : level ){
+                    if( lazy_->completionCache_.count( node ) == 0 ){
+                        lazy_->completionCache_.emplace( node, completions( node, CompletionCacheSize ) );
+                    }
+
+                    for( FlatTrie::Index child = trie_.begin( node ) ; child != trie_.end( node ) ; ++ child ){
+                        next.push_back( child );
+                    }
+                }
+
+                level.swap( next );
+            }
+        } );
+
+        return lazy_->completionCache_;
+    }
+
+    KeyboardLayout keyboardLayout_;
+
+private:
+    /*
+     * built from trie_ on first use, replaced with it
+     */
+
+    struct Lazy{
+        std::once_flag depthsOnce_;
+        std::unique_ptr< TrieDepths > depths_;
+
+        std::once_flag symSpellIndexOnce_;
+        std::unique_ptr< SymSpellIndex > symSpellIndex_;
+
+        std::once_flag completionCacheOnce_;
+        std::unordered_map< FlatTrie::Index, std::vector< Completion > > completionCache_;
+    };
+
+    FlatTrie trie_;
+    std::unique_ptr< Lazy > lazy_;
+};
+
+unsigned const Dictionary::CompletionCacheDepth;
+unsigned const Dictionary::CompletionCacheSize;
+
+/*
+ * SearchContext
+ *
+ * Per-query state of a search over a shared Dictionary. A context serves
+ * one query at a time, its pools are reused by the following queries.
+ */
+
+struct SearchContext{
+    typedef std::vector< TrieIterator * >::const_iterator iterator;
+    typedef std::vector< TrieIterator * >::const_iterator const_iterator;
+
+    SearchContext( Dictionary const & dictionary, SearchOptions const & options )
+        : dictionary_( dictionary )
+        , options_( options )
+        , counter_( 0 )
+        , generation_( 0 )
+        , queued_( 0 )
+        , settledCurrent_( 0 )
+        , peakFrontier_( 0 ){
+    }
+
+    SearchContext( SearchContext const & ) = delete;
+    SearchContext( SearchContext && ) = delete;
+
+    SearchContext & operator=( SearchContext const & ) = delete;
+    SearchContext & operator=( SearchContext && ) = delete;
+
+    void init(){
+        counter_ = 0;
+
+        finalize();
+        spawn( FlatTrie::Root, 0, nullptr );
+    }
+
+    void finalize(){
+        iterators_.clear();
+        pool_.reset();
+        paths_.reset();
+
+        for( auto const & worker : workers_ ){
+            worker->finalize();
+        }
+    }
+
+    void spawn( FlatTrie::Index const node, int const penalty, PathRecord const * const path, bool const skip = false ){
+        iterators_.push_back( pool_.create( node, penalty, path, skip ) );
+
+        if( Stats && path != nullptr ){
+            stats_.created( path->operation_ );
+        }
+    }
+
+    static double elapsed( std::chrono::steady_clock::time_point const start ){
+        return std::chrono::duration< double, std::nano >( std::chrono::steady_clock::now() - start ).count();
+    }
+
+    template< typename Policy >
+    void processLetter( Policy const & penaltyPolicy, char const c, char const nextLetterHint = char(0) ){
+        std::chrono::steady_clock::time_point start;
+
+        if( Stats ){
+            start = std::chrono::steady_clock::now();
+        }
+
+        if( options_.parallelThreshold_ != 0 && iterators_.size() >= options_.parallelThreshold_ ){
+            expandInParallel( penaltyPolicy, c, nextLetterHint );
+        }
+        else{
+            for( unsigned current = 0, end = iterators_.size() ; current != end ; ++ current ){
+                iterators_[ current ]->move( * this, penaltyPolicy, c, nextLetterHint );
+            }
+        }
+
+        //std::cout << "Iterator counter: " << iterators_.size() << std::endl;
+
+        peakFrontier_ = std::max< std::size_t >( peakFrontier_, iterators_.size() );
+
+        if( Stats ){
+            stats_.expandTime_ += elapsed( start );
+            stats_.pruned_.push_back( 0 );
+            start = std::chrono::steady_clock::now();
+        }
+
+        prune( penaltyPolicy.maxNumberOfMistakes( ++ counter_ ) );
+
+        if( options_.deduplicate_ && dictionary_.trie().minimized() == false ){
+            deduplicate();
+        }
+
+        for( TrieIterator * const i : iterators_ ){
+            if( i->deleted_ ){
+                i->path_ = paths_.create( i->path_, 'D' );
+                i->deleted_ = false;
+            }
+        }
+
+        if( Stats ){
+            stats_.pruneTime_ += elapsed( start );
+        }
+    }
+
+    /*
+     * drops iterators with a penalty above the given one
+     */
+
+    void prune( int const penalty ){
+        pruneIf( [ penalty ]( TrieIterator const * const node ){ return node->getPenalty() > penalty; } );
+    }
+
+    template< typename Predicate >
+    void pruneIf( Predicate const & predicate ){
+        auto const toBeRemoved = std::partition(
+            iterators_.begin(),
+            iterators_.end(),
+            [ & predicate ]( TrieIterator const * const node ){ return predicate( node ) == false; }
+        );
+
+        std::for_each(
+            toBeRemoved,
+            iterators_.end(),
+            [ this ]( TrieIterator * const node ){ pool_.release( node ); }
+        );
+
+        if( Stats ){
+            stats_.pruned( iterators_.end() - toBeRemoved );
+        }
+
+        iterators_.erase( toBeRemoved, iterators_.end() );
+    }
+
+    template< typename Policy >
+    void expandInParallel( Policy const & penaltyPolicy, char const c, char const nextLetterHint ){
+        unsigned const threads = options_.parallelThreads_ != 0
+            ? options_.parallelThreads_
+            : std::max( 1u, std::thread::hardware_concurrency() );
+
+        if( ! threadPool_ || threadPool_->size() != threads ){
+            threadPool_.reset();
+            threadPool_.reset( new ThreadPool( threads ) );
+        }
+
+        while( workers_.size() < threads ){
+            workers_.emplace_back( new SearchContext( dictionary_, options_ ) );
+        }
+
+        unsigned const size = iterators_.size();
+        unsigned const chunk = ( size + threads - 1 ) / threads;
+
+        threadPool_->run( [ this, & penaltyPolicy, c, nextLetterHint, size, chunk ]( unsigned const worker ){
+            SearchContext & context = * workers_[ worker ];
+            context.iterators_.clear();
+
+            for( unsigned current = worker * chunk, end = std::min( size, current + chunk ) ; current < end ; ++ current ){
+                iterators_[ current ]->move( context, penaltyPolicy, c, nextLetterHint );
+            }
+        } );
+
+        for( unsigned worker = 0 ; worker < threads ; ++ worker ){
+            std::vector< TrieIterator * > const & spawned = workers_[ worker ]->iterators_;
+            iterators_.insert( iterators_.end(), spawned.begin(), spawned.end() );
+
+            if( Stats ){
+                stats_.merge( workers_[ worker ]->stats_ );
+                workers_[ worker ]->stats_.clear();
+            }
+        }
+    }
+
+    void deduplicate(){
+        if( seenGeneration_.size() != 2 * dictionary_.trie().size() ){
+            seenGeneration_.assign( 2 * dictionary_.trie().size(), 0 );
+            seenIndex_.resize( 2 * dictionary_.trie().size() );
+            generation_ = 0;
+        }
+
+        if( ++ generation_ == 0 ){
+            std::fill( seenGeneration_.begin(), seenGeneration_.end(), 0 );
+            generation_ = 1;
+        }
+
+        unsigned kept = 0;
+
+        for( unsigned current = 0, end = iterators_.size() ; current != end ; ++ current ){
+            TrieIterator * const iterator = iterators_[ current ];
+
+            unsigned const key = 2 * iterator->node_ + iterator->skip_;
+
+            if( seenGeneration_[ key ] != generation_ ){
+                seenGeneration_[ key ] = generation_;
+                seenIndex_[ key ] = kept;
+                iterators_[ kept ++ ] = iterator;
+                continue;
+            }
+
+            TrieIterator * & best = iterators_[ seenIndex_[ key ] ];
+
+            if( iterator->penalty_ < best->penalty_ ){
+                pool_.release( best );
+                best = iterator;
+            }
+            else{
+                pool_.release( iterator );
+            }
+        }
+
+        if( Stats ){
+            stats_.pruned( iterators_.size() - kept );
+        }
+
+        iterators_.resize( kept );
+    }
+
+    iterator begin() const {
+        return iterators_.begin();
+    }
+
+    iterator end() const {
+        return iterators_.end();
+    }
+
+    std::vector< Suggestion > getScoredSuggestions( std::string const & word, unsigned const limit = 0 ){
+        return getScoredSuggestions( word, DefaultPenaltyPolicy( & dictionary_.keyboardLayout_ ), limit );
+    }
+
+    /*
+     * With a limit only the best limit suggestions are returned, always
+     * the first limit of the full list. Words reachable by deleting the
+     * rest of the input give an upper bound for the limit-th penalty,
+     * iterators above it are dropped early. Words of equal rank up to the
+     * limit-th are ordered by the full frontier, when there are some the
+     * word is searched again without a limit.
+     */
+
+    template< typename Policy >
+    std::vector< Suggestion > getScoredSuggestions(
+        std::string const & word,
+        Policy const & penaltyPolicy,
+        unsigned const limit = 0
+    ){
+        std::string const symbols = dictionary_.trie().alphabet_.encode( word );
+        std::vector< Suggestion > result = search( symbols, penaltyPolicy, limit );
+
+        decode( result, symbols, word );
+        return result;
+    }
+
+    /*
+     * Suggestions back to UTF-8. The input itself, returned for short and
+     * known words, is given back as typed, since its code points need not
+     * be in the alphabet.
+     */
+
+    void decode( std::vector< Suggestion > & suggestions, std::string const & symbols, std::string const & word ) const {
+        for( Suggestion & suggestion : suggestions ){
+            if( suggestion.word_ == symbols ){
+                suggestion.word_ = word;
+            }
+            else{
+                dictionary_.trie().alphabet_.decode( suggestion.word_ );
+            }
+        }
+    }
+
+    /*
+     * word and suggestions are strings of Alphabet symbols
+     */
+
+    template< typename Policy >
+    std::vector< Suggestion > search(
+        std::string const & word,
+        Policy const & penaltyPolicy,
+        unsigned const limit
+    ){
+        peakFrontier_ = 0;
+
+        if( Stats ){
+            stats_.clear();
+        }
+
+        if( word.size() < 2 ){
+            return std::vector< Suggestion >( 1, Suggestion{ word, 0, 0 } );
+        }
+
+        if( options_.acceptKnownWords_ && dictionary_.trie().contains( word.data(), word.data() + word.size() ) ){
+            return std::vector< Suggestion >( 1, Suggestion{ word, 0, 0 } );
+        }
+
+        if( options_.engine_ == SearchOptions::BestFirst && dictionary_.trie().minimized() == false && word.size() <= BestFirstMaxSize ){
+            return searchBestFirst( word, penaltyPolicy, limit );
+        }
+
+        if( options_.engine_ == SearchOptions::BitParallel && word.size() <= BitParallelDistance::MaxSize ){
+            return searchBitParallel( word, penaltyPolicy, limit );
+        }
+
+        if( options_.engine_ == SearchOptions::SymSpell && word.size() <= BitParallelDistance::MaxSize ){
+            return searchSymSpell( word, penaltyPolicy, limit );
+        }
+
+        init();
+        best_.clear();
+
+        for( unsigned i = 1 ; i < word.size() ; ++ i ){
+            processLetter( penaltyPolicy, word[ i - 1 ], word[ i ] );
+
+            if( Debug ){
+                for( auto const & i : (*this) ){
+                    std::cout << "> " << i->word() << " " << i->debug() << " " << i->penalty_ << std::endl;
+                }
+                std::cout << std::endl;
+            }
+
+            if( limit != 0 && boundBest( penaltyPolicy, word, limit ) ){
+                std::vector< Suggestion > result( best_ );
+
+                if( Stats ){
+                    stats_.peakFrontier_ = peakFrontier_;
+                }
+
+                finalize();
+                return result;
+            }
+        }
+
+        processLetter( penaltyPolicy, word[ word.size() - 1 ] );
+
+        std::vector< Suggestion > result = collect( penaltyPolicy, limit != 0 ? limit + 1 : 0 );
+
+        finalize();
+
+        /*
+         * once best_ is full iterators are dropped, which keeps every word
+         * up to the limit-th but may move words of equal rank in the final
+         * frontier; if any of them is tied the full list decides the cut
+         */
+
+        if( limit != 0 && best_.size() == limit ){
+            for( unsigned i = 0 ; i < limit && i + 1 < result.size() ; ++ i ){
+                if( penaltyPolicy.rank( result[ i ].penalty_, result[ i ].frequency_ ) == penaltyPolicy.rank( result[ i + 1 ].penalty_, result[ i + 1 ].frequency_ ) ){
+                    result = search( word, penaltyPolicy, 0 );
+                    break;
+                }
+            }
+        }
+
+        if( limit != 0 && result.size() > limit ){
+            result.resize( limit );
+        }
+
+        return result;
+    }
+
+    /*
+     * words of the frontier after the last letter, best ranked first
+     *
+     * The whole frontier is sorted, also with a limit, so the words kept
+     * at the cut and their order are those of the full list.
+     */
+
+    template< typename Policy >
+    std::vector< Suggestion > collect( Policy const & penaltyPolicy, unsigned const limit ){
+        std::chrono::steady_clock::time_point start;
+
+        if( Stats ){
+            start = std::chrono::steady_clock::now();
+        }
+
+        std::vector< TrieIterator * > iterators( begin(), end() );
+
+        FlatTrie const & trie = dictionary_.trie();
+
+        std::sort(
+            iterators.begin(),
+            iterators.end(),
+            [ & penaltyPolicy, & trie ]( TrieIterator const * const lhs, TrieIterator const * const rhs ){
+                return penaltyPolicy.rank( lhs->penalty_, trie.frequency( lhs->node_ ) )
+                    < penaltyPolicy.rank( rhs->penalty_, trie.frequency( rhs->node_ ) );
+            }
+        );
+
+        std::unordered_set< std::string > words;
+        std::vector< Suggestion > result;
+
+        for( auto const & i : iterators ){
+            if( limit != 0 && result.size() == limit ){
+                break;
+            }
+
+            if( trie.isEnd( i->node_ ) ){
+                std::string suggestion = i->word();
+
+                if( Debug ){
+                    std::cout << "> " << suggestion << " " << i->debug() << " " << i->penalty_ << std::endl;
+                }
+
+                if( words.insert( suggestion ).second ){
+                    result.push_back( Suggestion{ std::move( suggestion ), i->penalty_, trie.frequency( i->node_ ) } );
+                }
+            }
+        }
+
+        if( Stats ){
+            stats_.collectTime_ = elapsed( start );
+            stats_.peakFrontier_ = peakFrontier_;
+        }
+
+        return result;
+    }
+
+    /*
+     * Completion
+     *
+     * The best limit dictionary words starting with prefix, or with a
+     * word within the penalties of the fuzzy search for it. Words are
+     * ranked by the penalty of their prefix and their frequency, then
+     * the shortest and then in order of their letters come first. Every
+     * iterator left after the prefix waits in the queue with a bound from
+     * the most frequent word below it, and is expanded into its own best
+     * limit words only when it comes first. No other words of it can be
+     * needed: those ranked before them are either taken or beaten by the
+     * same word from another iterator. A limit of 0 returns all of them.
+     */
+
+    std::vector< Suggestion > getCompletions( std::string const & prefix, unsigned const limit ){
+        return getCompletions( prefix, DefaultPenaltyPolicy( & dictionary_.keyboardLayout_ ), limit );
+    }
+
+    template< typename Policy >
+    std::vector< Suggestion > getCompletions( std::string const & prefix, Policy const & penaltyPolicy, unsigned const limit ){
+        struct Entry{
+            int rank_;
+            unsigned length_;
+            std::string word_;
+            TrieIterator const * iterator_;
+            int penalty_;
+            unsigned frequency_;
+
+            bool operator<( Entry const & other ) const {
+                if( rank_ != other.rank_ ){
+                    return rank_ > other.rank_;
+                }
+
+                if( length_ != other.length_ ){
+                    return length_ > other.length_;
+                }
+
+                return word_ > other.word_;
+            }
+        };
+
+        Alphabet const & alphabet = dictionary_.trie().alphabet_;
+        std::string const symbols = alphabet.encode( prefix );
+        unsigned const bound = limit != 0 ? limit : std::numeric_limits< unsigned >::max();
+
+        peakFrontier_ = 0;
+
+        if( Stats ){
+            stats_.clear();
+        }
+
+        init();
+
+        for( unsigned i = 0 ; i < symbols.size() ; ++ i ){
+            processLetter( penaltyPolicy, symbols[ i ], i + 1 < symbols.size() ? symbols[ i + 1 ] : char( 0 ) );
+        }
+
+        std::unordered_map< FlatTrie::Index, std::vector< Completion > > const & cache = dictionary_.completionCache();
+
+        std::vector< Entry > queue;
+
+        for( TrieIterator const * const i : iterators_ ){
+            int const rank = penaltyPolicy.rank( i->penalty_, dictionary_.maxFrequency( i->node_ ) );
+            queue.push_back( Entry{ rank, 0, std::string(), i, i->penalty_, 0 } );
+        }
+
+        std::make_heap( queue.begin(), queue.end() );
+
+        std::unordered_set< std::string > words;
+        std::vector< Suggestion > result;
+
+        while( queue.empty() == false && result.size() < bound ){
+            std::pop_heap( queue.begin(), queue.end() );
+            Entry entry = std::move( queue.back() );
+            queue.pop_back();
+
+            if( entry.iterator_ == nullptr ){
+                if( words.insert( entry.word_ ).second ){
+                    result.push_back( Suggestion{ std::move( entry.word_ ), entry.penalty_, entry.frequency_ } );
+                }
+
+                continue;
+            }
+
+            auto const cached = limit != 0 && limit <= Dictionary::CompletionCacheSize
+                ? cache.find( entry.iterator_->node_ )
+                : cache.end();
+
+            std::vector< Completion > enumerated;
+
+            if( cached == cache.end() ){
+                enumerated = dictionary_.completions( entry.iterator_->node_, bound );
+            }
+
+            std::vector< Completion > const & completions = cached != cache.end() ? cached->second : enumerated;
+            std::string const word = entry.iterator_->word();
+
+            for( unsigned j = 0 ; j < completions.size() && j < bound ; ++ j ){
+                Completion const & completion = completions[ j ];
+                queue.push_back( Entry{
+                    penaltyPolicy.rank( entry.penalty_, completion.frequency_ ),
+                    unsigned( word.size() + completion.suffix_.size() ),
+                    word + completion.suffix_,
+                    nullptr,
+                    entry.penalty_,
+                    completion.frequency_
+                } );
+
+                std::push_heap( queue.begin(), queue.end() );
+            }
+        }
+
+        if( Stats ){
+            stats_.peakFrontier_ = peakFrontier_;
+        }
+
+        finalize();
+
+        for( Suggestion & suggestion : result ){
+            alphabet.decode( suggestion.word_ );
+        }
+
+        return result;
+    }
+
+    /*
+     * Typing session
+     *
+     * The word grows and shrinks one letter at a time. The frontier after
+     * letter i depends on letter i + 1, so a letter is processed for good
+     * when the next one is typed, and snapshots_[ i ] keeps the frontier
+     * after i letters by value. The last letter is processed on a copy
+     * for currentSuggestions, backspace only drops a snapshot. Suggestions
+     * are those of Lockstep for the whole word. A snapshot also records
+     * how much of paths_ and of the workers' paths_ its frontier uses,
+     * paths made after it are taken back whenever it is restored, so a
+     * context running a session must not run queries in between.
+     */
+
+    struct Snapshot{
+        std::vector< TrieIterator > iterators_;
+        unsigned paths_;
+        std::vector< unsigned > workerPaths_;
+    };
+
+    void beginSession(){
+        finalize();
+
+        session_.clear();
+        typed_.clear();
+        snapshots_.assign( 1, Snapshot{ std::vector< TrieIterator >( 1, TrieIterator( FlatTrie::Root, 0, nullptr ) ), 0, std::vector< unsigned >() } );
+        peakFrontier_ = 0;
+
+        if( Stats ){
+            stats_.clear();
+        }
+    }
+
+    void appendLetter( std::uint32_t const codePoint ){
+        appendLetter( DefaultPenaltyPolicy( & dictionary_.keyboardLayout_ ), codePoint );
+    }
+
+    template< typename Policy >
+    void appendLetter( Policy const & penaltyPolicy, std::uint32_t const codePoint ){
+        session_.push_back( char( dictionary_.trie().alphabet_.symbol( codePoint ) ) );
+        typed_.push_back( codePoint );
+
+        if( session_.size() < 2 ){
+            return;
+        }
+
+        restore( snapshots_.back(), snapshots_.size() - 1 );
+        processLetter( penaltyPolicy, session_[ session_.size() - 2 ], session_.back() );
+
+        snapshots_.push_back( Snapshot{ std::vector< TrieIterator >(), paths_.used_, std::vector< unsigned >() } );
+
+        for( TrieIterator const * const i : iterators_ ){
+            snapshots_.back().iterators_.push_back( * i );
+        }
+
+        for( auto const & worker : workers_ ){
+            snapshots_.back().workerPaths_.push_back( worker->paths_.used_ );
+        }
+    }
+
+    void backspace(){
+        if( session_.empty() ){
+            return;
+        }
+
+        session_.pop_back();
+        typed_.pop_back();
+
+        if( snapshots_.size() > 1 && snapshots_.size() > session_.size() ){
+            snapshots_.pop_back();
+        }
+
+        rollback( snapshots_.back() );
+    }
+
+    std::vector< Suggestion > currentSuggestions( unsigned const limit = 0 ){
+        return currentSuggestions( DefaultPenaltyPolicy( & dictionary_.keyboardLayout_ ), limit );
+    }
+
+    template< typename Policy >
+    std::vector< Suggestion > currentSuggestions( Policy const & penaltyPolicy, unsigned const limit = 0 ){
+        FlatTrie const & trie = dictionary_.trie();
+        std::vector< Suggestion > result;
+
+        if( session_.size() < 2 || ( options_.acceptKnownWords_ && trie.contains( session_.data(), session_.data() + session_.size() ) ) ){
+            result.push_back( Suggestion{ session_, 0, 0 } );
+        }
+        else{
+            restore( snapshots_.back(), snapshots_.size() - 1 );
+            processLetter( penaltyPolicy, session_.back() );
+            result = collect( penaltyPolicy, limit );
+        }
+
+        std::string word;
+
+        for( std::uint32_t const codePoint : typed_ ){
+            Alphabet::writeUtf8( codePoint, word );
+        }
+
+        decode( result, session_, word );
+        return result;
+    }
+
+    /*
+     * makes snapshot the frontier after letters letters
+     */
+
+    void restore( Snapshot const & snapshot, unsigned const letters ){
+        iterators_.clear();
+        pool_.reset();
+        rollback( snapshot );
+
+        for( TrieIterator const & i : snapshot.iterators_ ){
+            iterators_.push_back( pool_.create( i ) );
+        }
+
+        counter_ = letters;
+    }
+
+    /*
+     * takes back the paths made after snapshot, here and in the workers,
+     * a worker started after it made none before it; the iterators the
+     * workers spawned are copied into the snapshots, so their pools are
+     * reset
+     */
+
+    void rollback( Snapshot const & snapshot ){
+        paths_.rollback( snapshot.paths_ );
+
+        for( unsigned worker = 0 ; worker < workers_.size() ; ++ worker ){
+            workers_[ worker ]->iterators_.clear();
+            workers_[ worker ]->pool_.reset();
+            workers_[ worker ]->paths_.rollback( worker < snapshot.workerPaths_.size() ? snapshot.workerPaths_[ worker ] : 0 );
+        }
+    }
+
+    /*
+     * After letter counter_ of word: records in best_ the best ranked
+     * words completed by deleting the remaining letters, then drops
+     * iterators which cannot reach the limit-th of them, even with the
+     * most frequent word of their subtree. Returns true if best_ is the
+     * start of the full list: no word left can rank with or before the
+     * limit-th, and no two words of best_ are tied, whose order only the
+     * full frontier decides.
+     */
+
+    template< typename Policy >
+    bool boundBest( Policy const & penaltyPolicy, std::string const & word, unsigned const limit ){
+        FlatTrie const & trie = dictionary_.trie();
+
+        auto const rank = [ & penaltyPolicy ]( Suggestion const & suggestion ){
+            return penaltyPolicy.rank( suggestion.penalty_, suggestion.frequency_ );
+        };
+
+        /*
+         * the penalty of the word of the node of i, reached by deleting
+         * the remaining letters, -1 if it goes over the limits
+         */
+
+        auto const completion = [ this, & penaltyPolicy, & word ]( TrieIterator const * const i ){
+            char const previousLetter = PathRecord::letter( i->path_, 1 );
+            int penalty = i->penalty_;
+
+            for( unsigned j = counter_ ; j < word.size() ; ++ j ){
+                char const nextLetter = j + 1 < word.size() ? word[ j + 1 ] : char( 0 );
+                penalty += penaltyPolicy.deleteLetter( previousLetter, word[ j ], nextLetter );
+
+                if( penalty > penaltyPolicy.maxNumberOfMistakes( j + 1 ) ){
+                    return -1;
+                }
+            }
+
+            return penalty;
+        };
+
+        for( TrieIterator const * const i : iterators_ ){
+            if( i->skip_ || trie.isEnd( i->node_ ) == false ){
+                continue;
+            }
+
+            unsigned const frequency = trie.frequency( i->node_ );
+
+            if( best_.size() == limit && penaltyPolicy.rank( i->penalty_, frequency ) >= rank( best_.back() ) ){
+                continue;
+            }
+
+            int const penalty = completion( i );
+
+            if( penalty == -1 ){
+                continue;
+            }
+
+            if( best_.size() == limit && penaltyPolicy.rank( penalty, frequency ) >= rank( best_.back() ) ){
+                continue;
+            }
+
+            offerBest( penaltyPolicy, Suggestion{ i->word(), penalty, frequency }, limit );
+        }
+
+        if( best_.size() < limit ){
+            return false;
+        }
+
+        int const threshold = rank( best_.back() );
+
+        auto const bound = [ this, & penaltyPolicy ]( TrieIterator const * const i ){
+            return penaltyPolicy.rank( i->penalty_, dictionary_.maxFrequency( i->node_ ) );
+        };
+
+        pruneIf( [ & bound, threshold ]( TrieIterator const * const i ){ return bound( i ) > threshold; } );
+
+        for( unsigned i = 1 ; i < best_.size() ; ++ i ){
+            if( rank( best_[ i - 1 ] ) == rank( best_[ i ] ) ){
+                return false;
+            }
+        }
+
+        /*
+         * an iterator left may still reach words below its node, and the
+         * word of its node, which ranks with or before the limit-th only
+         * if it is already in best_
+         */
+
+        auto const done = [ & ]( TrieIterator const * const i ){
+            if( trie.children( i->node_ ) != 0 ){
+                return false;
+            }
+
+            if( trie.isEnd( i->node_ ) == false ){
+                return true;
+            }
+
+            unsigned const frequency = trie.frequency( i->node_ );
+
+            if( i->skip_ ){
+                return penaltyPolicy.rank( i->penalty_, frequency ) > threshold;
+            }
+
+            int const penalty = completion( i );
+
+            if( penalty == -1 || penaltyPolicy.rank( penalty, frequency ) != threshold ){
+                return true;
+            }
+
+            std::string const suggestion = i->word();
+
+            return std::any_of(
+                best_.begin(),
+                best_.end(),
+                [ & suggestion ]( Suggestion const & s ){ return s.word_ == suggestion; }
+            );
+        };
+
+        return std::all_of( iterators_.begin(), iterators_.end(), done );
+    }
+
+    /*
+     * Best-first engine
+     *
+     * A state is a trie node reached after position letters of the word,
+     * skip means the letter at position was consumed by a swap. States
+     * have the transitions and the per-letter limits of TrieIterator::move
+     * and are expanded in order of penalty plus a lower bound of what
+     * remains: letters left over the height of the subtree must be
+     * deleted, end nodes deeper than the letters left need inserts. The
+     * bound never drops by more than a step costs, so the first time a
+     * state is taken from the queue its penalty is minimal and words come
+     * out by penalty. With word frequencies the search does not stop at
+     * the limit, the words found are ranked at the end.
+     *
+     * Estimates are small integers that never decrease along a path, the
+     * queue is a bucket per estimate, scanned once from the lowest. A
+     * state carries the operation which reached it, its PathRecord is
+     * created only when it is settled. Settled positions are a bit mask
+     * per ( node, skip ), stamped with the query like deduplicate().
+     */
+
+    static unsigned const BestFirstMaxSize = 63;
+
+    struct State{
+        int estimate_;
+        int penalty_;
+        FlatTrie::Index node_;
+        unsigned position_;
+        bool skip_;
+        char operation_;
+        char letters_[ 2 ];
+        PathRecord const * parent_;
+    };
+
+    template< typename Policy >
+    std::vector< Suggestion > searchBestFirst(
+        std::string const & word,
+        Policy const & penaltyPolicy,
+        unsigned const limit
+    ){
+        FlatTrie const & trie = dictionary_.trie();
+        unsigned const size = word.size();
+
+        int const maxPenalty = penaltyPolicy.maxNumberOfMistakes( size );
+
+        std::chrono::steady_clock::time_point start;
+
+        if( Stats ){
+            start = std::chrono::steady_clock::now();
+        }
+
+        finalize();
+        queue_.resize( std::max< std::size_t >( queue_.size(), maxPenalty + 1 ) );
+        queued_ = 0;
+
+        if( settledGeneration_.size() != 2 * trie.size() ){
+            settledGeneration_.assign( 2 * trie.size(), 0 );
+            settled_.resize( 2 * trie.size() );
+            settledCurrent_ = 0;
+        }
+
+        if( ++ settledCurrent_ == 0 ){
+            std::fill( settledGeneration_.begin(), settledGeneration_.end(), 0 );
+            settledCurrent_ = 1;
+        }
+
+        for( std::vector< State > & bucket : queue_ ){
+            bucket.clear();
+        }
+
+        std::vector< Suggestion > result;
+
+        push( penaltyPolicy, word, FlatTrie::Root, 0, false, 0, nullptr, char( 0 ) );
+
+        for( int estimate = 0 ; estimate <= maxPenalty ; ){
+            if( queue_[ estimate ].empty() ){
+                estimate += 1;
+                continue;
+            }
+
+            State const state = queue_[ estimate ].back();
+            queue_[ estimate ].pop_back();
+            queued_ -= 1;
+
+            if( settle( state.node_, state.position_, state.skip_ ) == false ){
+                continue;
+            }
+
+            PathRecord const * const path = state.operation_ == char( 0 )
+                ? state.parent_
+                : paths_.create( state.parent_, state.operation_, state.letters_[ 0 ], state.letters_[ 1 ] );
+
+            if( Stats && state.operation_ != char( 0 ) ){
+                stats_.created( state.operation_ );
+            }
+
+            if( state.position_ == size ){
+                if( trie.isEnd( state.node_ ) ){
+                    result.push_back( Suggestion{ PathRecord::word( path ), state.penalty_, trie.frequency( state.node_ ) } );
+
+                    if( result.size() == limit && trie.frequencies() == false ){
+                        break;
+                    }
+                }
+
+                continue;
+            }
+
+            unsigned const position = state.position_ + 1;
+
+            if( state.skip_ ){
+                push( penaltyPolicy, word, state.node_, position, false, state.penalty_, path, char( 0 ) );
+                continue;
+            }
+
+            char const c = word[ state.position_ ];
+            char const nextLetter = position < size ? word[ position ] : char( 0 );
+
+            if( nextLetter != char( 0 ) ){
+                FlatTrie::Index const nextLetterIt = trie.find( state.node_, nextLetter );
+
+                if( nextLetterIt != FlatTrie::None ){
+                    FlatTrie::Index const cIt = trie.find( nextLetterIt, c );
+
+                    if( cIt != FlatTrie::None ){
+                        push(
+                            penaltyPolicy, word, cIt, position, true,
+                            state.penalty_ + penaltyPolicy.swapLetter( c, nextLetter ),
+                            path, 'S', nextLetter, c
+                        );
+                    }
+                }
+            }
+
+            for( FlatTrie::Index node = trie.begin( state.node_ ) ; node != trie.end( state.node_ ) ; ++ node ){
+                char const letter = trie.letter( node );
+                FlatTrie::Index const cIt = trie.find( node, c );
+
+                if( cIt != FlatTrie::None ){
+                    push(
+                        penaltyPolicy, word, cIt, position, false,
+                        state.penalty_ + penaltyPolicy.insertLetter( c, letter, nextLetter ),
+                        path, 'I', letter, c
+                    );
+                }
+
+                if( letter == c ){
+                    push(
+                        penaltyPolicy, word, node, position, false,
+                        state.penalty_ + penaltyPolicy.exactMatch( letter ),
+                        path, 'E', letter
+                    );
+                }
+                else{
+                    push(
+                        penaltyPolicy, word, node, position, false,
+                        state.penalty_ + penaltyPolicy.replaceLetter( c, letter, nextLetter ),
+                        path, 'R', letter
+                    );
+                }
+            }
+
+            char const previousLetter = PathRecord::letter( path, 1 );
+
+            push(
+                penaltyPolicy, word, state.node_, position, false,
+                state.penalty_ + penaltyPolicy.deleteLetter( previousLetter, c, nextLetter ),
+                path, 'D'
+            );
+
+            if( Stats ){
+                stats_.nodesVisited_ += 2 * trie.children( state.node_ );
+            }
+        }
+
+        finalize();
+
+        if( Stats ){
+            stats_.expandTime_ = elapsed( start );
+            start = std::chrono::steady_clock::now();
+        }
+
+        rankSuggestions( penaltyPolicy, result );
+
+        if( limit != 0 && result.size() > limit ){
+            result.resize( limit );
+        }
+
+        if( Stats ){
+            stats_.collectTime_ = elapsed( start );
+            stats_.peakFrontier_ = peakFrontier_;
+        }
+
+        return result;
+    }
+
+    template< typename Policy >
+    void push(
+        Policy const & penaltyPolicy,
+        std::string const & word,
+        FlatTrie::Index const node,
+        unsigned const position,
+        bool const skip,
+        int const penalty,
+        PathRecord const * const parent,
+        char const operation,
+        char const first = char( 0 ),
+        char const second = char( 0 )
+    ){
+        if( penalty > penaltyPolicy.maxNumberOfMistakes( position ) ){
+            return;
+        }
+
+        TrieDepths const & depths = dictionary_.depths();
+        unsigned const left = word.size() - position - skip;
+        unsigned const height = depths.height_[ node ];
+        unsigned const endDepth = depths.endDepth_[ node ];
+
+        int const estimate = penalty
+            + ( left > height ? left - height : 0 ) * penaltyPolicy.minDeleteLetter()
+            + ( endDepth > left ? endDepth - left : 0 ) * penaltyPolicy.minInsertLetter();
+
+        if( estimate > penaltyPolicy.maxNumberOfMistakes( word.size() ) ){
+            return;
+        }
+
+        if( settled( node, position, skip ) ){
+            return;
+        }
+
+        queue_[ estimate ].push_back( State{ estimate, penalty, node, position, skip, operation, { first, second }, parent } );
+        queued_ += 1;
+
+        peakFrontier_ = std::max< std::size_t >( peakFrontier_, queued_ );
+    }
+
+    bool settled( FlatTrie::Index const node, unsigned const position, bool const skip ) const {
+        unsigned const key = 2 * node + skip;
+        return settledGeneration_[ key ] == settledCurrent_ && ( settled_[ key ] >> position & 1 ) != 0;
+    }
+
+    /*
+     * marks the state settled, false if it already was
+     */
+
+    bool settle( FlatTrie::Index const node, unsigned const position, bool const skip ){
+        unsigned const key = 2 * node + skip;
+
+        if( settledGeneration_[ key ] != settledCurrent_ ){
+            settledGeneration_[ key ] = settledCurrent_;
+            settled_[ key ] = 0;
+        }
+
+        std::uint64_t const bit = std::uint64_t( 1 ) << position;
+
+        if( ( settled_[ key ] & bit ) != 0 ){
+            return false;
+        }
+
+        settled_[ key ] |= bit;
+        return true;
+    }
+
+    /*
+     * Bit-parallel engine
+     *
+     * Subtrees whose prefix is already more than maxDistance_ edits away
+     * are skipped, the penalty of every word left is computed on its own.
+     */
+
+    template< typename Policy >
+    std::vector< Suggestion > searchBitParallel(
+        std::string const & word,
+        Policy const & penaltyPolicy,
+        unsigned const limit
+    ){
+        BitParallelDistance const distance( word );
+        std::vector< Suggestion > result;
+        std::string prefix;
+
+        std::chrono::steady_clock::time_point start;
+
+        if( Stats ){
+            start = std::chrono::steady_clock::now();
+        }
+
+        walkBitParallel( penaltyPolicy, word, distance, FlatTrie::Root, distance.first(), prefix, result );
+
+        if( Stats ){
+            stats_.expandTime_ = elapsed( start );
+            start = std::chrono::steady_clock::now();
+        }
+
+        std::sort( result.begin(), result.end() );
+        rankSuggestions( penaltyPolicy, result );
+
+        if( limit != 0 && result.size() > limit ){
+            result.resize( limit );
+        }
+
+        if( Stats ){
+            stats_.collectTime_ = elapsed( start );
+            stats_.peakFrontier_ = peakFrontier_;
+        }
+
+        return result;
+    }
+
+    template< typename Policy >
+    std::vector< Suggestion > searchSymSpell(
+        std::string const & word,
+        Policy const & penaltyPolicy,
+        unsigned const limit
+    ){
+        FlatTrie const & trie = dictionary_.trie();
+        SymSpellIndex const & index = dictionary_.symSpellIndex();
+        BitParallelDistance const distance( word );
+        std::vector< Suggestion > result;
+
+        for( std::uint32_t const id : index.candidates( word, options_.maxDistance_ ) ){
+            std::string candidate = index.word( id );
+
+            if( distance.distance( candidate ) > options_.maxDistance_ ){
+                continue;
+            }
+
+            int const penalty = getPenalty( penaltyPolicy, word, candidate );
+
+            if( penalty != NoPenalty ){
+                unsigned const frequency = trie.frequencies()
+                    ? trie.frequency( trie.find( candidate.data(), candidate.data() + candidate.size() ) )
+                    : 0;
+
+                result.push_back( Suggestion{ std::move( candidate ), penalty, frequency } );
+            }
+        }
+
+        std::sort( result.begin(), result.end() );
+        rankSuggestions( penaltyPolicy, result );
+
+        if( limit != 0 && result.size() > limit ){
+            result.resize( limit );
+        }
+
+        return result;
+    }
+
+    template< typename Policy >
+    void walkBitParallel(
+        Policy const & penaltyPolicy,
+        std::string const & word,
+        BitParallelDistance const & distance,
+        FlatTrie::Index const node,
+        BitParallelDistance::Column const & column,
+        std::string & prefix,
+        std::vector< Suggestion > & result
+    ){
+        FlatTrie const & trie = dictionary_.trie();
+
+        /*
+         * the walk keeps a column per letter of prefix and one for the root
+         */
+
+        peakFrontier_ = std::max< std::size_t >( peakFrontier_, prefix.size() + 1 );
+
+        if( Stats ){
+            stats_.nodesVisited_ += trie.children( node );
+        }
+
+        if( trie.isEnd( node ) && column.distance_ <= options_.maxDistance_ ){
+            int const penalty = getPenalty( penaltyPolicy, word, prefix );
+
+            if( penalty != NoPenalty ){
+                result.push_back( Suggestion{ prefix, penalty, trie.frequency( node ) } );
+            }
+        }
+
+        for( FlatTrie::Index child = trie.begin( node ) ; child != trie.end( node ) ; ++ child ){
+            BitParallelDistance::Column const childColumn = distance.next( column, trie.letter( child ) );
+
+            if( distance.reachable( childColumn, options_.maxDistance_ ) ){
+                prefix.push_back( trie.letter( child ) );
+                walkBitParallel( penaltyPolicy, word, distance, child, childColumn, prefix, result );
+                prefix.pop_back();
+            }
+        }
+    }
+
+    static int const NoPenalty = std::numeric_limits< int >::max();
+
+    /*
+     * The cheapest way TrieIterator::move turns word into candidate, under
+     * the same per-letter limits, NoPenalty if there is none. Cell
+     * [ i ][ j ] holds the penalty of building i letters of candidate from
+     * j letters of word, the table is penaltyTable_ reused across calls.
+     */
+
+    template< typename Policy >
+    int getPenalty( Policy const & penaltyPolicy, std::string const & word, std::string const & candidate ){
+        unsigned const rows = candidate.size() + 1;
+        std::vector< int > & table = penaltyTable_;
+        table.assign( rows * ( word.size() + 1 ), NoPenalty );
+
+        /*
+         * the last row with a cell within the limits, most candidates of
+         * the walk fail a few letters in and stop there
+         */
+
+        unsigned reached = 0;
+
+        auto const relax = [ & ]( unsigned const i, unsigned const j, int const penalty ){
+            if( penalty <= penaltyPolicy.maxNumberOfMistakes( j ) ){
+                table[ j * rows + i ] = std::min( table[ j * rows + i ], penalty );
+                reached = std::max( reached, j );
+            }
+        };
+
+        table[ 0 ] = 0;
+
+        for( unsigned j = 0 ; j < word.size() ; ++ j ){
+            if( j > reached ){
+                return NoPenalty;
+            }
+
+            char const c = word[ j ];
+            char const nextLetter = j + 1 < word.size() ? word[ j + 1 ] : char( 0 );
+
+            for( unsigned i = 0 ; i < rows ; ++ i ){
+                int const penalty = table[ j * rows + i ];
+
+                if( penalty == NoPenalty ){
+                    continue;
+                }
+
+                char const previousLetter = i >= 2 ? candidate[ i - 2 ] : char( 0 );
+                relax( i, j + 1, penalty + penaltyPolicy.deleteLetter( previousLetter, c, nextLetter ) );
+
+                if( i == candidate.size() ){
+                    continue;
+                }
+
+                char const letter = candidate[ i ];
+
+                relax(
+                    i + 1,
+                    j + 1,
+                    penalty + ( letter == c ? penaltyPolicy.exactMatch( letter ) : penaltyPolicy.replaceLetter( c, letter, nextLetter ) )
+                );
+
+                if( i + 1 == candidate.size() ){
+                    continue;
+                }
+
+                if( candidate[ i + 1 ] == c ){
+                    relax( i + 2, j + 1, penalty + penaltyPolicy.insertLetter( c, letter, nextLetter ) );
+                }
+
+                if( nextLetter != char( 0 ) && letter == nextLetter && candidate[ i + 1 ] == c ){
+                    int const swapped = penalty + penaltyPolicy.swapLetter( c, nextLetter );
+
+                    if( swapped <= penaltyPolicy.maxNumberOfMistakes( j + 1 ) ){
+                        relax( i + 2, j + 2, swapped );
+                    }
+                }
+            }
+        }
+
+        return table[ word.size() * rows + candidate.size() ];
+    }
+
+    template< typename Policy >
+    void offerBest( Policy const & penaltyPolicy, Suggestion const & suggestion, unsigned const limit ){
+        auto const same = std::find_if(
+            best_.begin(),
+            best_.end(),
+            [ & suggestion ]( Suggestion const & s ){ return s.word_ == suggestion.word_; }
+        );
+
+        if( same != best_.end() ){
+            if( same->penalty_ <= suggestion.penalty_ ){
+                return;
+            }
+
+            best_.erase( same );
+        }
+        else if( best_.size() == limit ){
+            best_.pop_back();
+        }
+
+        best_.insert(
+            std::upper_bound(
+                best_.begin(),
+                best_.end(),
+                suggestion,
+                [ & penaltyPolicy ]( Suggestion const & lhs, Suggestion const & rhs ){
+                    return rankedBefore( penaltyPolicy, lhs, rhs );
+                }
+            ),
+            suggestion
+        );
+    }
+
+    template< typename Policy >
+    static bool rankedBefore( Policy const & penaltyPolicy, Suggestion const & lhs, Suggestion const & rhs ){
+        return penaltyPolicy.rank( lhs.penalty_, lhs.frequency_ ) < penaltyPolicy.rank( rhs.penalty_, rhs.frequency_ );
+    }
+
+    /*
+     * orders suggestions sorted by penalty by their rank, without
+     * frequencies the order stays as it is
+     */
+
+    template< typename Policy >
+    static void rankSuggestions( Policy const & penaltyPolicy, std::vector< Suggestion > & suggestions ){
+        std::stable_sort(
+            suggestions.begin(),
+            suggestions.end(),
+            [ & penaltyPolicy ]( Suggestion const & lhs, Suggestion const & rhs ){
+                return rankedBefore( penaltyPolicy, lhs, rhs );
+            }
+        );
+    }
+
+    Dictionary const & dictionary_;
+    SearchOptions const & options_;
+
+    unsigned counter_;
+    std::vector< TrieIterator * > iterators_;
+    Pool< TrieIterator > pool_;
+    Pool< PathRecord > paths_;
+    std::vector< unsigned > seenGeneration_;
+    std::vector< unsigned > seenIndex_;
+    unsigned generation_;
+    std::vector< Suggestion > best_;
+    std::vector< std::vector< State > > queue_;
+    std::size_t queued_;
+    std::vector< unsigned > settledGeneration_;
+    std::vector< std::uint64_t > settled_;
+    unsigned settledCurrent_;
+
+    /*
+     * scratch table of getPenalty
+     */
+
+    std::vector< int > penaltyTable_;
+
+    /*
+     * symbols and code points typed in the current session and frontiers
+     * after each processed letter
+     */
+
+    std::string session_;
+    std::vector< std::uint32_t > typed_;
+    std::vector< Snapshot > snapshots_;
+
+    /*
+     * the most iterators ( queued states for BestFirst, columns of the
+     * walk for BitParallel ) alive at once during the last query
+     */
+
+    std::size_t peakFrontier_;
+
+    QueryStats stats_;
+
+    /*
+     * used by expandInParallel, a worker's pools hold what it spawned
+     * until the end of the query
+     */
+
+    std::vector< std::unique_ptr< SearchContext > > workers_;
+    std::unique_ptr< ThreadPool > threadPool_;
+};
+
+int const SearchContext::NoPenalty;
+
+/*
+ * TrieIterator::move
+ */
+
+template< typename Policy >
+void TrieIterator::move( SearchContext & context, Policy const & penaltyPolicy, char const c, char const nextLetter ){
+    if( skip_ ){
+        skip_ = false;
+        return;
+    }
+
+    FlatTrie const & trie = context.dictionary_.trie();
+
+    if( nextLetter != char( 0 ) ){
+
+        FlatTrie::Index const nextLetterIt = trie.find( node_, nextLetter );
+
+        if( nextLetterIt != FlatTrie::None ){
+            FlatTrie::Index const cIt = trie.find( nextLetterIt, c );
+
+            if( cIt != FlatTrie::None ){
+                context.spawn(
+                    cIt,
+                    penalty_ + penaltyPolicy.swapLetter( c, nextLetter ),
+                    context.paths_.create( path_, 'S', nextLetter, c ),
+                    true
+                );
+            }
+        }
+    }
+
+    FlatTrie::Index const begin = trie.begin( node_ );
+    FlatTrie::Index const end = trie.end( node_ );
+
+    for( FlatTrie::Index node = begin ; node != end ; ++ node ){
+        FlatTrie::Index const cIt = trie.find( node, c );
+
+        if( cIt != FlatTrie::None ){
+            context.spawn(
+                cIt,
+                penalty_ + penaltyPolicy.insertLetter( c, trie.letter( node ), nextLetter ),
+                context.paths_.create( path_, 'I', trie.letter( node ), c )
+            );
+        }
+    }
+
+    for( FlatTrie::Index node = begin ; node != end ; ++ node ){
+        char const letter = trie.letter( node );
+
+        if( letter == c ){
+            context.spawn(
+                node,
+                penalty_ + penaltyPolicy.exactMatch( letter ),
+                context.paths_.create( path_, 'E', letter )
+            );
+        }
+        else{
+            context.spawn(
+                node,
+                penalty_ + penaltyPolicy.replaceLetter( c, letter, nextLetter ),
+                context.paths_.create( path_, 'R', letter )
+            );
+        }
+    }
+
+    char const previousLetter = PathRecord::letter( path_, 1 );
+    penalty_ += penaltyPolicy.deleteLetter( previousLetter, c, nextLetter );
+    deleted_ = true;
+
+    if( Stats ){
+        context.stats_.created( 'D' );
+        context.stats_.nodesVisited_ += 2 * ( end - begin );
+    }
+}
+
+/*
+ * ResultCache
+ *
+ * Thread-safe LRU of query results, bounded by a number of entries and
+ * by an estimate of their bytes, 0 means no bound. A key is the word
+ * followed by a fixed-length signature of the options that change the
+ * result. Words found in the dictionary and answered by themselves are
+ * kept as known entries without a suggestion list, words without any
+ * suggestions as empty lists.
+ */
+
+struct ResultCache{
+    /*
+     * rough cost of an entry besides its strings: list node, hash node
+     * and vector headers
+     */
+
+    static std::size_t const EntryOverhead = 128;
+
+    /*
+     * engine, maximum distance, flags and limit
+     */
+
+    static std::size_t const SignatureSize = 3 + sizeof( unsigned );
+
+    struct Entry{
+        std::string key_;
+        bool known_;
+        unsigned frequency_;
+        std::vector< Suggestion > suggestions_;
+        std::size_t bytes_;
+    };
+
+    ResultCache()
+        : maxEntries_( 0 )
+        , maxBytes_( 0 )
+        , enabled_( false )
+    {
+    }
+
+    ResultCache( ResultCache const & ) = delete;
+    ResultCache( ResultCache && ) = delete;
+
+    ResultCache & operator=( ResultCache const & ) = delete;
+    ResultCache & operator=( ResultCache && ) = delete;
+
+    static std::string key( std::string const & word, SearchOptions const & options, unsigned const limit ){
+        std::string result( word );
+
+        result.push_back( char( options.engine_ ) );
+        result.push_back( char( std::min( options.maxDistance_, 255u ) ) );
+        result.push_back( char( options.acceptKnownWords_ | ( options.deduplicate_ << 1 ) ) );
+        result.append( reinterpret_cast< char const * >( & limit ), sizeof( limit ) );
+
+        return result;
+    }
+
+    /*
+     * no bound on both means no cache
+     */
+
+    void setCapacity( std::size_t const maxEntries, std::size_t const maxBytes ){
+        std::lock_guard< std::mutex > lock( mutex_ );
+
+        maxEntries_ = maxEntries;
+        maxBytes_ = maxBytes;
+        enabled_ = maxEntries != 0 || maxBytes != 0;
+
+        evict();
+    }
+
+    bool enabled() const {
+        return enabled_;
+    }
+
+    bool find( std::string const & key, std::vector< Suggestion > & result ){
+        std::lock_guard< std::mutex > lock( mutex_ );
+
+        auto const it = index_.find( key );
+
+        if( it == index_.end() ){
+            stats_.misses_ += 1;
+            return false;
+        }
+
+        entries_.splice( entries_.begin(), entries_, it->second );
+
+        Entry const & entry = * it->second;
+
+        stats_.hits_ += 1;
+
+        if( entry.known_ ){
+            stats_.knownHits_ += 1;
+            result.assign( 1, Suggestion{ entry.key_.substr( 0, entry.key_.size() - SignatureSize ), 0, entry.frequency_ } );
+        }
+        else{
+            result = entry.suggestions_;
+        }
+
+        return true;
+    }
+
+    void insert( std::string const & key, std::vector< Suggestion > const & suggestions ){
+        Entry entry{ key, false, 0, std::vector< Suggestion >(), EntryOverhead + key.size() };
+
+        std::string const word = key.substr( 0, key.size() - SignatureSize );
+
+        if( suggestions.size() == 1 && suggestions[ 0 ].penalty_ == 0 && suggestions[ 0 ].word_ == word ){
+            entry.known_ = true;
+            entry.frequency_ = suggestions[ 0 ].frequency_;
+        }
+        else{
+            entry.suggestions_ = suggestions;
+
+            for( Suggestion const & suggestion : suggestions ){
+                entry.bytes_ += sizeof( Suggestion ) + suggestion.word_.size();
+            }
+        }
+
+        std::lock_guard< std::mutex > lock( mutex_ );
+
+        if( index_.count( key ) != 0 ){
+            return;
+        }
+
+        entries_.push_front( std::move( entry ) );
+        index_.emplace( key, entries_.begin() );
+
+        stats_.entries_ += 1;
+        stats_.bytes_ += entries_.front().bytes_;
+
+        evict();
+    }
+
+    void clear(){
+        std::lock_guard< std::mutex > lock( mutex_ );
+
+        entries_.clear();
+        index_.clear();
+        stats_.entries_ = 0;
+        stats_.bytes_ = 0;
+    }
+
+    CacheStats stats() const {
+        std::lock_guard< std::mutex > lock( mutex_ );
+        return stats_;
+    }
+
+    /*
+     * drops least recently used entries until both bounds hold
+     */
+
+    void evict(){
+        while(
+            entries_.empty() == false && (
+                ( maxEntries_ != 0 && stats_.entries_ > maxEntries_ ) ||
+                ( maxBytes_ != 0 && stats_.bytes_ > maxBytes_ ) ||
+                enabled() == false
+            )
+        ){
+            Entry const & entry = entries_.back();
+
+            stats_.entries_ -= 1;
+            stats_.bytes_ -= entry.bytes_;
+            stats_.evictions_ += 1;
+
+            index_.erase( entry.key_ );
+            entries_.pop_back();
+        }
+    }
+
+    mutable std::mutex mutex_;
+    std::list< Entry > entries_;
+    std::unordered_map< std::string, std::list< Entry >::iterator > index_;
+    std::size_t maxEntries_;
+    std::size_t maxBytes_;
+    std::atomic< bool > enabled_;
+    CacheStats stats_;
+};
+
+std::size_t const ResultCache::EntryOverhead;
+std::size_t const ResultCache::SignatureSize;
+
+/*
+ * SpellChecker
+ */
+
+struct SpellChecker{
+    SpellChecker( std::string const & fileName )
+        : dictionary_( fileName )
+        , context_( dictionary_, options_ )
+        , sessionContext_( dictionary_, options_ ){
+        sessionContext_.beginSession();
+    }
+
+    SpellChecker( SpellChecker const & ) = delete;
+    SpellChecker( SpellChecker && ) = delete;
+
+    SpellChecker & operator=( SpellChecker const & ) = delete;
+    SpellChecker & operator=( SpellChecker && ) = delete;
+
+    bool contains( std::string const & word ) const {
+        return dictionary_.contains( word );
+    }
+
+    /*
+     * limit 0 returns all suggestions, otherwise only the best limit ones
+     */
+
+    std::vector< Suggestion > getScoredSuggestions( std::string const & word, unsigned const limit = 0 ){
+        return getScoredSuggestions( context_, word, limit );
+    }
+
+    /*
+     * answers from resultCache_ when it is enabled, otherwise searches in
+     * context
+     */
+
+    std::vector< Suggestion > getScoredSuggestions( SearchContext & context, std::string const & word, unsigned const limit ){
+        if( resultCache_.enabled() == false ){
+            return context.getScoredSuggestions( word, limit );
+        }
+
+        std::string const key = ResultCache::key( word, options_, limit );
+        std::vector< Suggestion > result;
+
+        if( resultCache_.find( key, result ) == false ){
+            result = context.getScoredSuggestions( word, limit );
+            resultCache_.insert( key, result );
+        }
+        else if( Stats ){
+            context.stats_.clear();
+            context.stats_.cached_ = true;
+        }
+
+        return result;
+    }
+
+    /*
+     * results of repeated queries are kept up to maxEntries entries and
+     * about maxBytes bytes, 0 means no bound, 0 for both turns it off
+     */
+
+    void setCacheCapacity( std::size_t const maxEntries, std::size_t const maxBytes = 0 ){
+        resultCache_.setCapacity( maxEntries, maxBytes );
+    }
+
+    CacheStats cacheStats() const {
+        return resultCache_.stats();
+    }
+
+    /*
+     * the best limit words completing prefix, which may be misspelled
+     */
+
+    std::vector< Suggestion > getCompletions( std::string const & prefix, unsigned const limit = 10 ){
+        return context_.getCompletions( prefix, limit );
+    }
+
+    /*
+     * A word typed letter by letter: each call costs about one letter of
+     * search, currentSuggestions returns what getScoredSuggestions would
+     * for the word typed so far with the Lockstep engine. Sessions have
+     * their own context, queries may come in between.
+     */
+
+    void beginSession(){
+        sessionContext_.beginSession();
+    }
+
+    void appendLetter( std::uint32_t const codePoint ){
+        sessionContext_.appendLetter( codePoint );
+    }
+
+    void backspace(){
+        sessionContext_.backspace();
+    }
+
+    std::vector< Suggestion > currentSuggestions( unsigned const limit = 0 ){
+        return sessionContext_.currentSuggestions( limit );
+    }
+
+    /*
+     * counters of the last query, empty unless built with SPELLCHECKER_STATS,
+     * and of the result cache
+     */
+
+    QueryStats stats() const {
+        QueryStats result = context_.stats_;
+        result.cache_ = resultCache_.stats();
+        return result;
+    }
+
+    std::vector< std::string > getSuggestionsImpl( std::string const & word, unsigned const limit = 0 ){
+        return toWords( getScoredSuggestions( word, limit ) );
+    }
+
+    std::vector< std::string > getSuggestions( std::string const & word, unsigned const limit = 0 ){
+        if( Debug ){
+            std::vector< std::string > result;
+            test( [ this, & word, limit, & result ](){ result = this->getSuggestionsImpl( word, limit ); } );
+            return result;
+        }
+        else{
+            return this->getSuggestionsImpl( word, limit );
+        }
+    }
+
+    /*
+     * Spreads words over a pool of threads, 0 means one per core. Every
+     * worker has its own SearchContext, the dictionary is shared.
+     */
+
+    std::vector< std::vector< std::string > > getSuggestionsBatch(
+        std::vector< std::string > const & words,
+        unsigned threads = 0
+    ){
+        if( threads == 0 ){
+            threads = std::max( 1u, std::thread::hardware_concurrency() );
+        }
+
+        if( ! threadPool_ || threadPool_->size() != threads ){
+            threadPool_.reset();
+            threadPool_.reset( new ThreadPool( threads ) );
+        }
+
+        while( contexts_.size() < threads ){
+            contexts_.emplace_back( new SearchContext( dictionary_, options_ ) );
+        }
+
+        std::vector< std::vector< std::string > > result( words.size() );
+        std::atomic< unsigned > next( 0 );
+
+        threadPool_->run( [ this, & words, & result, & next ]( unsigned const worker ){
+            SearchContext & context = * contexts_[ worker ];
+
+            for( unsigned i = next ++ ; i < words.size() ; i = next ++ ){
+                result[ i ] = toWords( getScoredSuggestions( context, words[ i ], 0 ) );
+            }
+        } );
+
+        return result;
+    }
+
+    static std::vector< std::string > toWords( std::vector< Suggestion > const & suggestions ){
+        std::vector< std::string > result;
+
+        for( Suggestion const & suggestion : suggestions ){
+            result.push_back( suggestion.word_ );
+        }
+
+        return result;
+    }
+
+    Dictionary dictionary_;
+    SearchOptions options_;
+    SearchContext context_;
+    SearchContext sessionContext_;
+    std::vector< std::unique_ptr< SearchContext > > contexts_;
+    std::unique_ptr< ThreadPool > threadPool_;
+    ResultCache resultCache_;
+};
+
+/*
+ * DocumentChecker
+ *
+ * Reads a stream in large chunks and reports misspelled words with their
+ * byte offsets. Words are looked up in place in the trie, only the
+ * misspelled ones are copied and sent to the fuzzy search. Text is read
+ * as UTF-8, typographic quotes and dashes separate words like ASCII
+ * punctuation does, and ’ is an apostrophe.
+ */
+
+struct DocumentChecker{
+    static std::size_t const ChunkSize = 1 << 20;
+
+    DocumentChecker( SpellChecker & spellChecker )
+        : spellChecker_( spellChecker )
+    {
+    }
+
+    static std::uint32_t const Apostrophe = 0x2019;
+
+    /*
+     * bytes of the letter at begin, 0 if it separates words. Digits are
+     * letters too, so 123abc is one token, skipped by checkWord. Bytes
+     * which are not valid UTF-8, like a sequence cut at the end of a
+     * chunk, are letters, so the word is kept for the next chunk.
+     */
+
+    static std::size_t letter( char const * const begin, char const * const end ){
+        unsigned char const c = * begin;
+
+        if( c < 0x80 ){
+            return std::isalnum( c ) || c == '\'' ? 1 : 0;
+        }
+
+        char const * next = begin;
+        std::uint32_t const codePoint = Alphabet::readUtf8( next, end );
+
+        return isSeparator( codePoint ) ? 0 : next - begin;
+    }
+
+    /*
+     * Latin-1 punctuation and symbols, General Punctuation ( quotes,
+     * dashes, spaces ), CJK punctuation and the byte order mark
+     */
+
+    static bool isSeparator( std::uint32_t const codePoint ){
+        if( codePoint >= 0x80 && codePoint <= 0xBF ){
+            return codePoint != 0xAA && codePoint != 0xB5 && codePoint != 0xBA;
+        }
+
+        return codePoint == 0xD7
+            || codePoint == 0xF7
+            || ( codePoint >= 0x2000 && codePoint <= 0x206F && codePoint != Apostrophe )
+            || ( codePoint >= 0x3000 && codePoint <= 0x303F )
+            || codePoint == 0xFEFF;
+    }
+
+    /*
+     * bytes of an apostrophe at begin, 0 if there is none
+     */
+
+    static std::size_t apostrophe( char const * const begin, char const * const end ){
+        if( * begin == '\'' ){
+            return 1;
+        }
+
+        char const * next = begin;
+        return Alphabet::readUtf8( next, end ) == Apostrophe ? next - begin : 0;
+    }
+
+    /*
+     * a capitalized word is also accepted when its lower case form is in
+     * the dictionary, wherever it is: sentences are not tracked, so
+     * "Spell" in the middle of a sentence is accepted too
+     */
+
+    bool known( char const * const begin, char const * const end ) const {
+        if( Alphabet::ascii( begin, end ) ){
+            return knownSymbols( begin, end, static_cast< unsigned char >( * begin ) );
+        }
+
+        char const * next = begin;
+        std::uint32_t const first = Alphabet::readUtf8( next, end );
+
+        std::string const symbols = spellChecker_.dictionary_.trie().alphabet_.encode( begin, end );
+        return knownSymbols( symbols.data(), symbols.data() + symbols.size(), first );
+    }
+
+    /*
+     * symbols of a word, first is the code point of its first letter,
+     * which need not be in the alphabet when it is a capital
+     */
+
+    bool knownSymbols( char const * const begin, char const * const end, std::uint32_t const first ) const {
+        FlatTrie const & trie = spellChecker_.dictionary_.trie();
+
+        if( trie.contains( begin, end ) ){
+            return true;
+        }
+
+        std::uint32_t const lower = Alphabet::toLower( first );
+
+        if( lower == first ){
+            return false;
+        }
+
+        unsigned char const symbol = trie.alphabet_.symbol( lower );
+
+        if( symbol == Alphabet::Unknown ){
+            return false;
+        }
+
+        FlatTrie::Index const node = trie.find( FlatTrie::Root, char( symbol ) );
+
+        return node != FlatTrie::None && trie.contains( begin + 1, end, node );
+    }
+
+    void check( std::istream & input, std::ostream & output ){
+        std::vector< char > buffer( ChunkSize );
+
+        std::uint64_t offset = 0;
+        std::size_t kept = 0;
+        bool eof = false;
+
+        while( eof == false ){
+            if( kept == buffer.size() ){
+                buffer.resize( 2 * buffer.size() );
+            }
+
+            input.read( buffer.data() + kept, buffer.size() - kept );
+
+            std::size_t const size = kept + input.gcount();
+            eof = ! input;
+            bytes_ += input.gcount();
+
+            char const * const data = buffer.data();
+            std::size_t current = 0;
+
+            while( current < size ){
+                std::size_t length = letter( data + current, data + size );
+
+                if( length == 0 ){
+                    char const * next = data + current;
+                    Alphabet::readUtf8( next, data + size );
+                    current = next - data;
+                    continue;
+                }
+
+                std::size_t end = current;
+
+                while( length != 0 ){
+                    end += length;
+                    length = end < size ? letter( data + end, data + size ) : 0;
+                }
+
+                if( end == size && eof == false ){
+                    break;
+                }
+
+                checkWord( data + current, data + end, offset + current, output );
+                current = end;
+            }
+
+            std::memmove( buffer.data(), data + current, size - current );
+            kept = size - current;
+            offset += current;
+        }
+    }
+
+    void checkWord( char const * begin, char const * end, std::uint64_t offset, std::ostream & output ){
+        for( std::size_t length ; begin != end && ( length = apostrophe( begin, end ) ) != 0 ; ){
+            begin += length;
+            offset += length;
+        }
+
+        while( begin != end ){
+            if( * ( end - 1 ) == '\'' ){
+                end -= 1;
+            }
+            else if( end - begin >= 3 && apostrophe( end - 3, end ) == 3 ){
+                end -= 3;
+            }
+            else{
+                break;
+            }
+        }
+
+        if( begin == end ){
+            return;
+        }
+
+        /*
+         * numbers, codes and ordinals like 2nd are not words
+         */
+
+        if( std::find_if( begin, end, []( char const c ){ return c >= '0' && c <= '9'; } ) != end ){
+            return;
+        }
+
+        words_ += 1;
+
+        /*
+         * a word without a ’ is looked up in place, one with it as typed
+         * with a ' instead; a string is built only for the latter and for
+         * a misspelled word
+         */
+
+        static char const curly[] = "\xE2\x80\x99";
+        std::string word;
+
+        if( std::search( begin, end, curly, curly + 3 ) == end ){
+            if( known( begin, end ) ){
+                return;
+            }
+
+            word.assign( begin, end );
+        }
+        else{
+            for( char const * letter = begin ; letter != end ; ){
+                std::size_t const length = apostrophe( letter, end );
+
+                if( length > 1 ){
+                    word.push_back( '\'' );
+                    letter += length;
+                }
+                else{
+                    word.push_back( * letter ++ );
+                }
+            }
+
+            if( known( word.data(), word.data() + word.size() ) ){
+                return;
+            }
+        }
+
+        misspellings_ += 1;
+
+        output << offset << '\t' << std::string( begin, end ) << '\t';
+
+        char const * separator = "";
+
+        for( std::string const & suggestion : spellChecker_.getSuggestions( word ) ){
+            output << separator << suggestion;
+            separator = " ";
+        }
+
+        output << '\n';
+    }
+
+    SpellChecker & spellChecker_;
+    std::uint64_t bytes_ = 0;
+    std::uint64_t words_ = 0;
+    std::uint64_t misspellings_ = 0;
+};
+
+std::uint32_t const DocumentChecker::Apostrophe;
+
+/*
+ * Micro-benchmarks
+ */
+
+/*
+ * replace penalty looked up in the keyboard map on every call, as it was
+ * before KeyboardLayout::replaceCosts_
+ */
+
+struct MapPenaltyPolicy : PenaltyPolicy{
+    MapPenaltyPolicy( KeyboardLayout const * keyboardLayout )
+        : PenaltyPolicy( keyboardLayout )
+    {
+    }
+
+    int replaceLetter( char const currentLetter, char const replaceLetter, char const nextLetter = char( 0 ) ) const override {
+        int const cost = KeyboardLayout::replaceCost( keyboardLayout_->distance( currentLetter, replaceLetter ) );
+
+        if( nextLetter == char( 0 ) ){
+            return cost;
+        }
+
+        return std::min( cost, int( KeyboardLayout::replaceCost( keyboardLayout_->distance( replaceLetter, nextLetter ) ) ) );
+    }
+};
+
+template< typename T >
+double measure( T const & t ){
+    using namespace std::chrono;
+
+    steady_clock::time_point const start = steady_clock::now();
+    t();
+    return duration< double, std::nano >( steady_clock::now() - start ).count();
+}
+
+std::vector< std::string > const microbenchWords = {
+    "english", "spell", "checker", "boys", "sister", "England", "mitigate",
+    "Alexander", "zoologists", "Bournemouth", "Mephistopheles", "abracadabra"
+};
+
+/*
+ * average time of processLetter in searches for microbenchWords
+ */
+
+template< typename Policy >
+double perLetter( SpellChecker & sc, Policy const & penaltyPolicy ){
+    unsigned const repeat = 20;
+    unsigned letters = 0;
+
+    for( std::string const & word : microbenchWords ){
+        letters += repeat * word.size();
+    }
+
+    return measure( [ & sc, & penaltyPolicy ](){
+        for( unsigned i = 0 ; i < repeat ; ++ i ){
+            for( std::string const & word : microbenchWords ){
+                sc.context_.getScoredSuggestions( word, penaltyPolicy );
+            }
+        }
+    } ) / letters;
+}
+
+/*
+ * dictionary words reached by random walks down the trie
+ */
+
+std::vector< std::string > randomWords( FlatTrie const & trie, unsigned const count, unsigned const seed ){
+    std::mt19937 random( seed );
+    std::vector< std::string > result;
+
+    while( result.size() < count ){
+        std::string word;
+
+        for( FlatTrie::Index node = FlatTrie::Root ; ; ){
+            if( trie.isEnd( node ) && ( trie.children( node ) == 0 || random() % 4 == 0 ) ){
+                break;
+            }
+
+            node = trie.begin( node ) + random() % trie.children( node );
+            word.push_back( trie.letter( node ) );
+        }
+
+        result.push_back( word );
+    }
+
+    return result;
+}
+
+/*
+ * average time of looking up one of words, letter by letter with find
+ */
+
+template< typename Find >
+double perLookup( FlatTrie const & trie, std::vector< std::string > const & words, Find const & find ){
+    unsigned const repeat = 10;
+    unsigned found = 0;
+
+    double const result = measure( [ & ](){
+        for( unsigned i = 0 ; i < repeat ; ++ i ){
+            for( std::string const & word : words ){
+                FlatTrie::Index node = FlatTrie::Root;
+
+                for( char const c : word ){
+                    node = find( node, c );
+                }
+
+                found += trie.isEnd( node );
+            }
+        }
+    } ) / ( repeat * words.size() );
+
+    if( found != repeat * words.size() ){
+        throw std::runtime_error( "perLookup: word not found" );
+    }
+
+    return result;
+}
+
+/*
+ * average time of a search for one of microbenchWords with an engine
+ */
+
+double perQuery( SpellChecker & sc, SearchOptions::Engine const engine ){
+    unsigned const repeat = 20;
+    SearchOptions::Engine const previous = sc.options_.engine_;
+
+    sc.options_.engine_ = engine;
+
+    double const result = measure( [ & sc ](){
+        for( unsigned i = 0 ; i < repeat ; ++ i ){
+            for( std::string const & word : microbenchWords ){
+                sc.getScoredSuggestions( word );
+            }
+        }
+    } ) / ( repeat * microbenchWords.size() );
+
+    sc.options_.engine_ = previous;
+
+    return result;
+}
+
+/*
+ * average time of a keystroke typing microbenchWords, suggestions are
+ * taken after every letter
+ */
+
+double perKeystroke( SpellChecker & sc, bool const session ){
+    unsigned keystrokes = 0;
+
+    for( std::string const & word : microbenchWords ){
+        keystrokes += word.size();
+    }
+
+    return measure( [ & sc, session ](){
+        for( std::string const & word : microbenchWords ){
+            sc.beginSession();
+
+            for( unsigned i = 0 ; i < word.size() ; ++ i ){
+                if( session ){
+                    sc.appendLetter( word[ i ] );
+                    sc.currentSuggestions();
+                }
+                else{
+                    sc.getScoredSuggestions( word.substr( 0, i + 1 ) );
+                }
+            }
+        }
+    } ) / keystrokes;
+}
+
+void microbench( SpellChecker & sc ){
+    KeyboardLayout const * const keyboardLayout = & sc.dictionary_.keyboardLayout_;
+
+    perLetter( sc, DefaultPenaltyPolicy( keyboardLayout ) );
+
+    std::cout << "processLetter, virtual policy, replace cost from map: "
+        << perLetter( sc, MapPenaltyPolicy( keyboardLayout ) ) << "ns" << std::endl;
+
+    std::cout << "processLetter, virtual policy, replace cost from table: "
+        << perLetter( sc, PenaltyPolicy( keyboardLayout ) ) << "ns" << std::endl;
+
+    std::cout << "processLetter, static policy: "
+        << perLetter( sc, DefaultPenaltyPolicy( keyboardLayout ) ) << "ns" << std::endl;
+
+    FlatTrie const & trie = sc.dictionary_.trie();
+    std::vector< std::string > const words = randomWords( trie, 100000, 1 );
+
+    std::cout << "lookup, scalar: " << perLookup( trie, words, [ & trie ]( FlatTrie::Index const node, char const c ){
+        return trie.findScalar( trie.begin( node ), trie.children( node ), c );
+    } ) << "ns" << std::endl;
+
+    std::cout << "lookup, find: " << perLookup( trie, words, [ & trie ]( FlatTrie::Index const node, char const c ){
+        return trie.find( node, c );
+    } ) << "ns" << std::endl;
+
+    std::cout << "query, lockstep: " << perQuery( sc, SearchOptions::Lockstep ) << "ns" << std::endl;
+    std::cout << "query, best-first: " << perQuery( sc, SearchOptions::BestFirst ) << "ns" << std::endl;
+
+    double const cache = measure( [ & sc ](){ sc.dictionary_.completionCache(); } );
+
+    std::cout << "completion cache: " << sc.dictionary_.completionCache().size() << " nodes, built in "
+        << cache / 1e6 << "ms" << std::endl;
+
+    std::vector< std::string > prefixes;
+
+    for( std::string const & word : microbenchWords ){
+        prefixes.push_back( word.substr( 0, 2 ) );
+        prefixes.push_back( word.substr( 0, 3 ) );
+    }
+
+    std::cout << "completion, 2 and 3 letters, top 8: " << measure( [ & sc, & prefixes ](){
+        for( std::string const & prefix : prefixes ){
+            sc.getCompletions( prefix, 8 );
+        }
+    } ) / prefixes.size() << "ns" << std::endl;
+
+    sc.setCacheCapacity( 1000 );
+    perQuery( sc, SearchOptions::Lockstep );
+    std::cout << "query, cached: " << perQuery( sc, SearchOptions::Lockstep ) << "ns" << std::endl;
+    sc.setCacheCapacity( 0 );
+
+    std::cout << "keystroke, whole word: " << perKeystroke( sc, false ) << "ns" << std::endl;
+    std::cout << "keystroke, session: " << perKeystroke( sc, true ) << "ns" << std::endl;
+
+    std::unique_ptr< SymSpellIndex > index;
+
+    double const build = measure( [ & sc, & index ](){ index.reset( new SymSpellIndex( sc.dictionary_.trie() ) ); } );
+
+    std::cout << "symspell index: " << index->size() << " words, "
+        << index->hashes_.size() << " entries, "
+        << index->bytes() << " bytes, built in "
+        << build / 1e6 << "ms" << std::endl;
+
+    sc.dictionary_.symSpellIndex();
+
+    for( unsigned const maxDistance : { 1u, 2u } ){
+        unsigned const previous = sc.options_.maxDistance_;
+        sc.options_.maxDistance_ = maxDistance;
+
+        std::cout << "query, bit-parallel, max distance " << maxDistance << ": "
+            << perQuery( sc, SearchOptions::BitParallel ) << "ns" << std::endl;
+
+        std::cout << "query, symspell, max distance " << maxDistance << ": "
+            << perQuery( sc, SearchOptions::SymSpell ) << "ns" << std::endl;
+
+        sc.options_.maxDistance_ = previous;
+    }
+}
+
+/*
+ * load time of a dictionary file word by word through Node, and with
+ * Dictionary::build on one thread and on all cores
+ */
+
+void perLoad( std::string const & name, std::string const & fileName ){
+    FlatTrie trie;
+
+    double const nodes = measure( [ & fileName, & trie ](){ trie = Dictionary::readByNodes( fileName ); } );
+
+    double const single = measure( [ & fileName, & trie ](){
+        MappedFile const file( fileName );
+        trie = Dictionary::build( WordList( file.data_, file.data_ + file.size_ ), 1 );
+    } );
+
+    double const parallel = measure( [ & fileName, & trie ](){
+        MappedFile const file( fileName );
+        trie = Dictionary::build( WordList( file.data_, file.data_ + file.size_ ) );
+    } );
+
+    std::cout << "load " << name << ", " << trie.size() << " nodes: by nodes " << nodes / 1e6
+        << "ms, built on one thread " << single / 1e6
+        << "ms, on " << std::thread::hardware_concurrency() << " threads " << parallel / 1e6 << "ms" << std::endl;
+}
+
+void microbenchLoad( SpellChecker & sc, std::string const & fileName ){
+    if( FlatTrie::isCompiled( fileName ) == false ){
+        perLoad( "dictionary", fileName );
+    }
+
+    char synthetic[] = "/tmp/spellChecker-XXXXXX";
+    int const fd = ::mkstemp( synthetic );
+
+    if( fd == -1 ){
+        return;
+    }
+
+    ::close( fd );
+
+    {
+        std::ofstream file( synthetic );
+        std::vector< std::string > const words = randomWords( sc.dictionary_.trie(), 100000, 7 );
+        char const * const suffixes[] = { "", "s", "ed", "ing", "er", "est", "ly", "ness", "less", "ful" };
+
+        for( char const * const suffix : suffixes ){
+            for( std::string word : words ){
+                sc.dictionary_.trie().alphabet_.decode( word );
+                file << word << suffix << "\n";
+            }
+        }
+    }
+
+    perLoad( "1M lines", synthetic );
+
+    std::remove( synthetic );
+}
+
+/*
+ * Benchmark
+ *
+ * A reproducible corpus of misspellings: a few real ones and dictionary
+ * words with 1 to 3 random edits of their letters, decoded to UTF-8.
+ * A cold pass runs it on a new search context, a warm pass repeats it
+ * on the same one.
+ */
+
+std::vector< std::string > const benchMisspellings = {
+    "teh", "recieve", "wierd", "definately", "seperate", "accomodate", "occured",
+    "untill", "begining", "beleive", "goverment", "neccessary", "tommorow", "wich"
+};
+
+std::vector< std::string > benchCorpus( FlatTrie const & trie, unsigned const count, unsigned const seed ){
+    std::mt19937 random( seed );
+    std::vector< std::string > result( benchMisspellings );
+
+    for( std::string word : randomWords( trie, count, seed ) ){
+        unsigned const distance = 1 + result.size() % 3;
+
+        for( unsigned i = 0 ; i < distance ; ++ i ){
+            unsigned const position = random() % ( word.size() + 1 );
+            char const letter = 'a' + random() % 26;
+
+            switch( random() % 4 ){
+                case 0:
+                    word.insert( word.begin() + position, letter );
+                    break;
+                case 1:
+                    if( position < word.size() && word.size() > 1 ){
+                        word.erase( position, 1 );
+                    }
+                    break;
+                case 2:
+                    if( position < word.size() ){
+                        word[ position ] = letter;
+                    }
+                    break;
+                default:
+                    if( position + 1 < word.size() ){
+                        std::swap( word[ position ], word[ position + 1 ] );
+                    }
+                    break;
+            }
+        }
+
+        trie.alphabet_.decode( word );
+        result.push_back( word );
+    }
+
+    return result;
+}
+
+/*
+ * counts operator new on each thread, the benchmark reports allocations
+ * per query; only built with SPELLCHECKER_STATS, so other builds keep the
+ * library allocator
+ */
+
+#ifdef SPELLCHECKER_STATS
+
+thread_local std::uint64_t allocations = 0;
+
+void * operator new( std::size_t const size ){
+    allocations += 1;
+
+    if( void * const result = std::malloc( size != 0 ? size : 1 ) ){
+        return result;
+    }
+
+    throw std::bad_alloc();
+}
+
+void * operator new( std::size_t const size, std::nothrow_t const & ) noexcept {
+    allocations += 1;
+    return std::malloc( size != 0 ? size : 1 );
+}
+
+void operator delete( void * const pointer ) noexcept {
+    std::free( pointer );
+}
+
+void operator delete( void * const pointer, std::nothrow_t const & ) noexcept {
+    std::free( pointer );
+}
+
+#else
+
+std::uint64_t const allocations = 0;
+
+#endif
+
+void benchPass( std::string const & name, SearchContext & context, std::vector< std::string > const & corpus ){
+    using namespace std::chrono;
+
+    std::vector< double > latencies;
+    latencies.reserve( corpus.size() );
+
+    std::size_t peakFrontier = 0;
+    std::uint64_t const allocationsBefore = allocations;
+
+    for( std::string const & word : corpus ){
+        steady_clock::time_point const start = steady_clock::now();
+        context.getScoredSuggestions( word );
+        latencies.push_back( duration< double, std::micro >( steady_clock::now() - start ).count() );
+
+        peakFrontier = std::max( peakFrontier, context.peakFrontier_ );
+    }
+
+    std::uint64_t const queryAllocations = allocations - allocationsBefore;
+    double const total = std::accumulate( latencies.begin(), latencies.end(), 0.0 );
+
+    std::sort( latencies.begin(), latencies.end() );
+
+    auto const percentile = [ & latencies ]( double const p ){
+        return latencies[ std::min< std::size_t >( latencies.size() - 1, p * latencies.size() ) ];
+    };
+
+    std::cout
+        << name << ": "
+        << corpus.size() << " queries in " << total / 1e6 << "s, "
+        << corpus.size() / ( total / 1e6 ) << " queries/s, "
+        << "p50 " << percentile( 0.5 ) << "us, "
+        << "p90 " << percentile( 0.9 ) << "us, "
+        << "p99 " << percentile( 0.99 ) << "us, "
+        << "max " << latencies.back() << "us, "
+        << "peak frontier " << peakFrontier;
+
+    if( Stats ){
+        std::cout << ", " << 1.0 * queryAllocations / corpus.size() << " allocations/query";
+    }
+
+    std::cout << std::endl;
+}
+
+void bench( SpellChecker & sc ){
+    std::vector< std::string > const corpus = benchCorpus( sc.dictionary_.trie(), 2000, 1 );
+
+    std::cout << "corpus: " << corpus.size() << " words, "
+        << benchMisspellings.size() << " listed, the rest at distance 1 to 3" << std::endl;
+
+    SearchContext context( sc.dictionary_, sc.options_ );
+
+    benchPass( "cold", context, corpus );
+    benchPass( "warm", context, corpus );
+}
+
+void test( SpellChecker & sc )
+{
+    {
+        std::vector< std::string > const actual = sc.getSuggestions( "english" );
+        std::vector< std::string > const expected = {
+            "English", "neglig", "enlist"
+        };
+        assert( actual == expected );
+    }
+
+    {
+        std::vector< std::string > const actual = sc.getSuggestions( "spell" );
+        std::vector< std::string > const expected = {
+            "spell", "swell","Aspell", "sell", "Ispell", "spool", "spelt"
+        };
+        assert( actual == expected );
+    }
+
+    {
+        std::vector< std::string > const actual = sc.getSuggestions( "checker" );
+        std::vector< std::string > const expected = { 
+            "checker", "checked", "checks", "chewer",  "cheeked", "heckler", "check",
+            "chewed"
+        };
+        assert( actual == expected );
+    }
+
+    {
+        std::vector< std::string > const actual = sc.getSuggestions( "a" );
+        std::vector< std::string > const expected = { 
+            "a"
+        };
+        assert( actual == expected );
+    }
+
+    {
+        std::vector< std::string > const actual = sc.getSuggestions( "by" );
+        std::vector< std::string > const expected = { 
+            "by", "b", "y", "Ty", "bay", "boy", "buy", "Yb" 
+        };
+        assert( actual == expected );
+    }
+
+    {
+        std::vector< std::string > const actual = sc.getSuggestions( "cad" );
+        std::vector< std::string > const expected = { 
+            "cad", "car", "dad", "fad", "sad", "wad", "card", "ad", "Ada", "clad", "scad"
+        };
+        assert( actual == expected );
+    }
+
+    {
+        std::vector< std::string > const actual = sc.getSuggestions( "boys" );
+        std::vector< std::string > const expected = { 
+            "boys", "boss", "buys", "bows", "bogs", "bobs", "boas", "Boas", "boy",
+            "buoys", "boy's", "Boyd", "bode"
+        };
+        assert( actual == expected );
+    }
+
+    {
+        std::vector< std::string > const actual = sc.getSuggestions( "empty" );
+        std::vector< std::string > const expected = { 
+            "empty"
+        };
+        assert( actual == expected );
+    }
+
+    {
+        std::vector< std::string > const actual = sc.getSuggestions( "sister" );
+        std::vector< std::string > const expected = { 
+            "sister", "Sister", "sitter", "sifter", "mister", "Mister", "sifted",
+            "misted", "kisser", "sissier", "sited", "mistier", "dissed", "sassed",
+            "sieved", "kissed", "site", "missed"
+        };
+        assert( actual == expected );
+    }
+
+    {
+        std::vector< std::string > const actual = sc.getSuggestions( "England" );
+        std::vector< std::string > const expected = { 
+            "England"
+        };
+        assert( actual == expected );
+    }
+
+    {
+        std::vector< std::string > const actual = sc.getSuggestions( "mitigate" );
+        std::vector< std::string > const expected = { 
+            "mitigate", "motivate"
+        };
+        assert( actual == expected );
+    }
+
+    {
+        std::vector< std::string > const actual = sc.getSuggestions( "Alexander" );
+        std::vector< std::string > const expected = { 
+            "Alexander", "Alexandra"
+        };
+        assert( actual == expected );
+    }
+
+    {
+        std::vector< std::string > const actual = sc.getSuggestions( "zoologist" );
+        std::vector< std::string > const expected = { 
+            "zoologist",
+            "zoology"
+        };
+        assert( actual == expected );
+    }
+
+    {
+        std::vector< std::string > const words = {
+            "english", "spell", "checker", "by", "cad", "boys", "sister",
+            "mitigate", "zoologist", "abracadabra"
+        };
+
+        for( std::string const & word : words ){
+            sc.options_.deduplicate_ = false;
+            std::vector< Suggestion > expected = sc.getScoredSuggestions( word );
+
+            sc.options_.deduplicate_ = true;
+            std::vector< Suggestion > actual = sc.getScoredSuggestions( word );
+
+            sc.options_.deduplicate_ = false;
+
+            assert( std::is_sorted( actual.begin(), actual.end(),
+                []( Suggestion const & lhs, Suggestion const & rhs ){ return lhs.penalty_ < rhs.penalty_; } ) );
+
+            std::sort( expected.begin(), expected.end() );
+            std::sort( actual.begin(), actual.end() );
+            assert( actual == expected );
+        }
+    }
+
+    {
+        char fileName[] = "/tmp/spellChecker-XXXXXX";
+        int const fd = ::mkstemp( fileName );
+        assert( fd != -1 );
+        ::close( fd );
+
+        sc.dictionary_.trie().save( fileName );
+        assert( FlatTrie::isCompiled( fileName ) );
+
+        {
+            SpellChecker mapped( fileName );
+            assert( mapped.dictionary_.trie().size() == sc.dictionary_.trie().size() );
+            assert( mapped.getSuggestions( "spell" ) == sc.getSuggestions( "spell" ) );
+            assert( mapped.getSuggestions( "sister" ) == sc.getSuggestions( "sister" ) );
+            assert( mapped.getSuggestions( "Ataturk" ) == sc.getSuggestions( "Ataturk" ) );
+        }
+
+        FlatTrie const & trie = sc.dictionary_.trie();
+
+        auto const corrupted = [ & trie, & fileName ]( std::size_t const offset, std::uint64_t const value ){
+            std::shared_ptr< std::vector< char > > const image( new std::vector< char >( trie.image_, trie.image_ + trie.bytes() ) );
+
+            if( offset < sizeof( FlatTrie::Header ) ){
+                std::memcpy( image->data() + offset, & value, sizeof( value ) );
+            }
+            else{
+                image->data()[ offset ] = char( value );
+            }
+
+            {
+                std::ofstream file( fileName, std::ios::binary );
+                file.write( image->data(), image->size() );
+            }
+
+            try{
+                TrieDepths( FlatTrie::map( fileName ) );
+            }
+            catch( std::runtime_error const & ){
+                return true;
+            }
+
+            return false;
+        };
+
+        FlatTrie::Header header;
+        std::memcpy( & header, trie.image_, sizeof( header ) );
+
+        assert( corrupted( offsetof( FlatTrie::Header, first_ ), std::uint64_t( 1 ) << 40 ) );
+        assert( corrupted( offsetof( FlatTrie::Header, letters_ ), header.imageSize_ ) );
+        assert( corrupted( offsetof( FlatTrie::Header, count_ ), header.imageSize_ - 1 ) );
+        assert( corrupted( offsetof( FlatTrie::Header, first_ ), header.first_ + 1 ) );
+        assert( corrupted( header.count_ + trie.size() - 1, 255 ) );
+        assert( corrupted( header.first_ + sizeof( FlatTrie::Index ), 1 ) );
+        assert( corrupted( header.count_, 0 ) == false );
+
+        std::remove( fileName );
+    }
+
+    {
+        FlatTrie const trie = sc.dictionary_.trie();
+        FlatTrie const dawg = FlatTrie::minimize( trie );
+
+        assert( dawg.minimized() );
+        assert( dawg.size() < trie.size() );
+
+        for( FlatTrie::Index node = 0 ; node < dawg.size() ; ++ node ){
+            assert( dawg.children( node ) == 0 || dawg.begin( node ) > node );
+        }
+        assert( TrieStats( dawg ).wordsCounter_ < TrieStats( trie ).wordsCounter_ );
+
+        std::vector< std::string > const words = {
+            "english", "spell", "checker", "boys", "sister", "Alexander"
+        };
+
+        for( std::string const & word : words ){
+            std::vector< std::string > const expected = sc.getSuggestions( word );
+
+            sc.dictionary_.setTrie( dawg );
+            std::vector< std::string > const actual = sc.getSuggestions( word );
+            sc.dictionary_.setTrie( trie );
+
+            assert( actual == expected );
+        }
+
+        /*
+         * what was built from the old trie is dropped with it
+         */
+
+        assert( sc.dictionary_.depths().height_.size() == trie.size() );
+        sc.dictionary_.setTrie( dawg );
+        assert( sc.dictionary_.depths().height_.size() == dawg.size() );
+        sc.dictionary_.setTrie( trie );
+        assert( sc.dictionary_.depths().height_.size() == trie.size() );
+    }
+
+    {
+        std::vector< std::string > const words = {
+            "english", "spell", "checker", "a", "by", "cad", "boys", "empty",
+            "sister", "England", "mitigate", "Alexander", "zoologist"
+        };
+
+        for( unsigned threads = 1 ; threads <= 4 ; threads *= 2 ){
+            std::vector< std::vector< std::string > > const actual = sc.getSuggestionsBatch( words, threads );
+
+            assert( actual.size() == words.size() );
+
+            for( unsigned i = 0 ; i < words.size() ; ++ i ){
+                assert( actual[ i ] == sc.getSuggestions( words[ i ] ) );
+            }
+        }
+
+        std::vector< std::vector< std::string > > expected;
+
+        for( std::string const & word : words ){
+            expected.push_back( sc.getSuggestions( word ) );
+        }
+
+        sc.options_.parallelThreshold_ = 1;
+
+        for( unsigned threads = 1 ; threads <= 3 ; ++ threads ){
+            sc.options_.parallelThreads_ = threads;
+
+            for( unsigned i = 0 ; i < words.size() ; ++ i ){
+                assert( sc.getSuggestions( words[ i ] ) == expected[ i ] );
+            }
+        }
+
+        sc.options_.parallelThreshold_ = 0;
+        sc.options_.parallelThreads_ = 0;
+    }
+
+    {
+        std::istringstream input( "The spell chekcer's\nis 'right' and shuold\tbe fast" );
+        std::ostringstream output;
+
+        DocumentChecker checker( sc );
+        checker.check( input, output );
+
+        std::string const expected =
+            "10\tchekcer's\tchecker's checkers's chewer's choker's checkers checkered choice's chewers checker chokers\n"
+            "35\tshuold\tshould shooed shoed shills\n";
+
+        assert( output.str() == expected );
+        assert( checker.words_ == 9 );
+        assert( checker.misspellings_ == 2 );
+        assert( checker.bytes_ == input.str().size() );
+    }
+
+    {
+        std::istringstream input( "“The spell” is good — really. It’s ‘right’ and shuold\u2009be fast…" );
+        std::ostringstream output;
+
+        DocumentChecker checker( sc );
+        checker.check( input, output );
+
+        assert( output.str() == "59\tshuold\tshould shooed shoed shills\n" );
+        assert( checker.words_ == 11 );
+        assert( checker.misspellings_ == 1 );
+    }
+
+    {
+        std::istringstream input( "123abc costs 2nd 4x4 R2D2 and 10" );
+        std::ostringstream output;
+
+        DocumentChecker checker( sc );
+        checker.check( input, output );
+
+        assert( output.str().empty() );
+        assert( checker.words_ == 2 );
+    }
+
+    {
+        assert( sc.contains( "England" ) );
+        assert( sc.contains( "boy's" ) );
+        assert( sc.contains( "Englan" ) == false );
+        assert( sc.contains( "Englandd" ) == false );
+        assert( sc.contains( "" ) == false );
+
+        std::vector< std::string > const misspelled = sc.getSuggestions( "splel" );
+
+        sc.options_.acceptKnownWords_ = true;
+
+        assert( sc.getSuggestions( "spell" ) == std::vector< std::string >( 1, "spell" ) );
+        assert( sc.getSuggestions( "checker" ) == std::vector< std::string >( 1, "checker" ) );
+        assert( sc.getSuggestions( "splel" ) == misspelled );
+
+        sc.options_.acceptKnownWords_ = false;
+
+        assert( sc.getSuggestions( "spell" ).size() > 1 );
+    }
+
+    {
+        KeyboardLayout const & keyboardLayout = sc.dictionary_.keyboardLayout_;
+
+        PenaltyPolicy tablePolicy( & keyboardLayout );
+        MapPenaltyPolicy mapPolicy( & keyboardLayout );
+
+        std::unordered_set< unsigned > diacritics;
+
+        for( auto const & letter : keyboardLayout.diacritics_ ){
+            diacritics.insert( static_cast< unsigned char >( letter.first ) );
+        }
+
+        for( unsigned c1 = 1 ; c1 < 256 ; ++ c1 ){
+            for( unsigned c2 = 1 ; c2 < 256 ; c2 += 7 ){
+                if( diacritics.count( c1 ) || diacritics.count( c2 ) ){
+                    continue;
+                }
+
+                assert( tablePolicy.replaceLetter( c1, c2 ) == mapPolicy.replaceLetter( c1, c2 ) );
+                assert( tablePolicy.replaceLetter( c1, c2, 'e' ) == mapPolicy.replaceLetter( c1, c2, 'e' ) );
+            }
+        }
+
+        assert( keyboardLayout.replaceCost( 'q', 'q' ) == 2 );
+        assert( keyboardLayout.replaceCost( 'q', 'w' ) == 2 );
+        assert( keyboardLayout.replaceCost( 'q', 'p' ) == 4 );
+        assert( keyboardLayout.replaceCost( 'q', '\t' ) == 4 );
+    }
+
+    {
+        PenaltyPolicy const penaltyPolicy( & sc.dictionary_.keyboardLayout_ );
+
+        for( std::string const & word : microbenchWords ){
+            assert( sc.context_.getScoredSuggestions( word, penaltyPolicy ) == sc.getScoredSuggestions( word ) );
+        }
+    }
+
+    {
+        /*
+         * the best limit suggestions are the first limit of the full list,
+         * words tied at the cut included
+         */
+
+        std::vector< std::string > words( microbenchWords );
+        words.insert( words.end(), { "by", "cad", "boys", "sister", "spell" } );
+
+        for( std::string const & word : words ){
+            std::vector< Suggestion > const all = sc.getScoredSuggestions( word );
+
+            for( unsigned const limit : { 1u, 2u, 3u, 5u, 10u } ){
+                std::vector< Suggestion > const top = sc.getScoredSuggestions( word, limit );
+
+                assert( top.size() == std::min< std::size_t >( limit, all.size() ) );
+                assert( std::equal( top.begin(), top.end(), all.begin() ) );
+            }
+        }
+
+        assert( sc.getSuggestions( "cad", 3 ) == std::vector< std::string >( { "cad", "car", "dad" } ) );
+        assert( sc.getSuggestions( "english", 1 ) == std::vector< std::string >( 1, "English" ) );
+    }
+
+    {
+        /*
+         * BestFirst orders words of equal penalty its own way, each group
+         * of equal penalty has to hold the same words as with Lockstep
+         */
+
+        auto const groups = []( std::vector< Suggestion > const & suggestions ){
+            std::vector< std::pair< int, std::vector< std::string > > > result;
+
+            for( Suggestion const & suggestion : suggestions ){
+                if( result.empty() || result.back().first != suggestion.penalty_ ){
+                    result.emplace_back( suggestion.penalty_, std::vector< std::string >() );
+                }
+
+                result.back().second.push_back( suggestion.word_ );
+            }
+
+            for( auto & group : result ){
+                std::sort( group.second.begin(), group.second.end() );
+            }
+
+            return result;
+        };
+
+        std::vector< std::string > words( microbenchWords );
+        words.insert( words.end(), { "a", "by", "cad", "empty", "zoologist", "teh", "recieve", "seperate", "definately", "Englnad" } );
+
+        for( std::string const & word : words ){
+            sc.options_.engine_ = SearchOptions::Lockstep;
+            std::vector< Suggestion > const expected = sc.getScoredSuggestions( word );
+
+            sc.options_.engine_ = SearchOptions::BestFirst;
+            std::vector< Suggestion > const actual = sc.getScoredSuggestions( word );
+            std::vector< Suggestion > const top = sc.getScoredSuggestions( word, 3 );
+
+            assert( groups( actual ) == groups( expected ) );
+            assert( top.size() == std::min< std::size_t >( 3, actual.size() ) );
+            assert( std::equal( top.begin(), top.end(), actual.begin() ) );
+        }
+
+        sc.options_.engine_ = SearchOptions::Lockstep;
+    }
+
+    {
+        auto const distance = []( std::string const & lhs, std::string const & rhs ){
+            std::vector< std::vector< unsigned > > table( lhs.size() + 1, std::vector< unsigned >( rhs.size() + 1 ) );
+
+            for( unsigned i = 0 ; i <= lhs.size() ; ++ i ){
+                for( unsigned j = 0 ; j <= rhs.size() ; ++ j ){
+                    if( i == 0 || j == 0 ){
+                        table[ i ][ j ] = i + j;
+                        continue;
+                    }
+
+                    table[ i ][ j ] = std::min( {
+                        table[ i - 1 ][ j ] + 1,
+                        table[ i ][ j - 1 ] + 1,
+                        table[ i - 1 ][ j - 1 ] + ( lhs[ i - 1 ] != rhs[ j - 1 ] )
+                    } );
+
+                    if( i > 1 && j > 1 && lhs[ i - 1 ] == rhs[ j - 2 ] && lhs[ i - 2 ] == rhs[ j - 1 ] ){
+                        table[ i ][ j ] = std::min( table[ i ][ j ], table[ i - 2 ][ j - 2 ] + 1 );
+                    }
+                }
+            }
+
+            return table[ lhs.size() ][ rhs.size() ];
+        };
+
+        std::vector< std::string > words( microbenchWords );
+        words.insert( words.end(), { "", "a", "ab", "ba", "teh", "recieve", "seperate", "definately", "Englnad", "abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghijkl" } );
+
+        for( std::string const & lhs : words ){
+            BitParallelDistance const bitParallel( lhs );
+
+            for( std::string const & rhs : words ){
+                assert( bitParallel.distance( rhs ) == distance( rhs, lhs ) );
+            }
+        }
+
+        auto const sorted = []( std::vector< Suggestion > suggestions ){
+            std::sort( suggestions.begin(), suggestions.end() );
+            return suggestions;
+        };
+
+        for( std::string const & word : words ){
+            if( word.size() < 2 || word.size() > BitParallelDistance::MaxSize ){
+                continue;
+            }
+
+            for( unsigned const maxDistance : { 1u, 2u } ){
+                sc.options_.engine_ = SearchOptions::Lockstep;
+                std::vector< Suggestion > expected;
+
+                for( Suggestion const & suggestion : sc.getScoredSuggestions( word ) ){
+                    if( distance( suggestion.word_, word ) <= maxDistance ){
+                        expected.push_back( suggestion );
+                    }
+                }
+
+                sc.options_.engine_ = SearchOptions::BitParallel;
+                sc.options_.maxDistance_ = maxDistance;
+                std::vector< Suggestion > const actual = sc.getScoredSuggestions( word );
+
+                assert( actual == sorted( expected ) );
+
+                sc.options_.engine_ = SearchOptions::SymSpell;
+                assert( sc.getScoredSuggestions( word ) == actual );
+            }
+        }
+
+        sc.options_.engine_ = SearchOptions::Lockstep;
+        sc.options_.maxDistance_ = 1;
+    }
+
+    {
+        FlatTrie const & trie = sc.dictionary_.trie();
+        FlatTrie const dawg = FlatTrie::minimize( trie );
+
+        for( FlatTrie const * const t : { & trie, & dawg } ){
+            assert( t->padded_ );
+
+            for( FlatTrie::Index node = 0 ; node < t->size() ; ++ node ){
+                if( t->children( node ) <= FlatTrie::VectorThreshold ){
+                    continue;
+                }
+
+                for( unsigned c = 0 ; c < 256 ; ++ c ){
+                    FlatTrie::Index const expected = t->findScalar( t->begin( node ), t->children( node ), c );
+
+                    assert( t->find( node, c ) == expected );
+
+#ifdef SPELLCHECKER_X86_SIMD
+                    assert( t->findSse2( t->begin( node ), t->children( node ), c ) == expected );
+
+                    if( FlatTrie::HasAvx2 ){
+                        assert( t->findAvx2( t->begin( node ), t->children( node ), c ) == expected );
+                    }
+#endif
+                }
+            }
+        }
+
+        for( std::string const & word : randomWords( trie, 1000, 2 ) ){
+            assert( trie.contains( word.data(), word.data() + word.size() ) );
+        }
+    }
+
+    {
+        SymSpellIndex const & index = sc.dictionary_.symSpellIndex();
+
+        for( std::string const & word : randomWords( sc.dictionary_.trie(), 100, 3 ) ){
+            std::vector< std::uint32_t > const candidates = index.candidates( word, 0 );
+
+            assert( std::any_of(
+                candidates.begin(),
+                candidates.end(),
+                [ & index, & word ]( std::uint32_t const id ){ return index.word( id ) == word; }
+            ) );
+        }
+
+        bool thrown = false;
+
+        try{
+            index.candidates( "english", SymSpellIndex::MaxDistance + 1 );
+        }
+        catch( std::runtime_error const & ){
+            thrown = true;
+        }
+
+        assert( thrown );
+    }
+
+    {
+        Alphabet alphabet;
+
+        std::string const polish = "Zażółć gęślą jaźń";
+
+        for( char const * begin = polish.data(), * const end = begin + polish.size() ; begin != end ; ){
+            alphabet.add( Alphabet::readUtf8( begin, end ) );
+        }
+
+        std::string const symbols = alphabet.encode( polish );
+        assert( symbols.size() == 17 );
+        assert( static_cast< unsigned char >( symbols[ 1 ] ) == 'a' );
+        assert( static_cast< unsigned char >( symbols[ 2 ] ) == Alphabet::First );
+
+        std::string decoded = symbols;
+        alphabet.decode( decoded );
+        assert( decoded == polish );
+
+        std::string const invalid = "a\xff\xc3" "b\xe2\x82";
+        decoded = alphabet.encode( invalid );
+        assert( decoded.size() == invalid.size() );
+        assert( static_cast< unsigned char >( decoded[ 1 ] ) == Alphabet::Unknown );
+
+        for( char const * begin = invalid.data(), * const end = begin + invalid.size() ; begin != end ; ){
+            alphabet.add( Alphabet::readUtf8( begin, end ) );
+        }
+
+        decoded = alphabet.encode( invalid );
+        alphabet.decode( decoded );
+        assert( decoded == invalid );
+
+        assert( static_cast< unsigned char >( alphabet.encode( "\xc3\xa9" )[ 0 ] ) == Alphabet::Unknown );
+        assert( KeyboardLayout::baseLetter( 0xE9 ) == 'e' );
+        assert( KeyboardLayout::baseLetter( 0xFF ) == 'y' );
+        assert( KeyboardLayout::baseLetter( 0x17C ) == 'z' );
+        assert( KeyboardLayout::baseLetter( 0xD7 ) == 0 );
+    }
+
+    {
+        char fileName[] = "/tmp/spellChecker-XXXXXX";
+        int const fd = ::mkstemp( fileName );
+        assert( fd != -1 );
+        ::close( fd );
+
+        {
+            std::ofstream file( fileName );
+            file << "łąka\nlaska\nżaba\nźle\nzle\nmąka\n";
+        }
+
+        {
+            SpellChecker polish( fileName );
+            Alphabet const & alphabet = polish.dictionary_.trie().alphabet_;
+            KeyboardLayout const & keyboardLayout = polish.dictionary_.keyboardLayout_;
+
+            char const a = alphabet.encode( "ą" )[ 0 ];
+            char const z1 = alphabet.encode( "ż" )[ 0 ];
+            char const z2 = alphabet.encode( "ź" )[ 0 ];
+
+            assert( keyboardLayout.replaceCost( a, 'a' ) == 1 );
+            assert( keyboardLayout.replaceCost( 'z', z1 ) == 1 );
+            assert( keyboardLayout.replaceCost( z1, z2 ) == 1 );
+            assert( keyboardLayout.replaceCost( a, 's' ) == keyboardLayout.replaceCost( 'a', 's' ) + 1 );
+            assert( keyboardLayout.replaceCost( a, 'p' ) == 4 );
+
+            assert( keyboardLayout.replaceCost( a, z1 ) == keyboardLayout.replaceCost( a, 'z' ) );
+            assert( keyboardLayout.replaceCost( z1, a ) == keyboardLayout.replaceCost( 'z', 'a' ) + 1 );
+            assert( keyboardLayout.replaceCost( z1, a ) < 4 );
+
+            assert( polish.contains( "łąka" ) );
+            assert( polish.contains( "laka" ) == false );
+
+            std::vector< Suggestion > const laka = polish.getScoredSuggestions( "laka" );
+            assert( laka.empty() == false );
+            assert( laka[ 0 ] == ( Suggestion{ "łąka", 2, 0 } ) );
+
+            std::vector< Suggestion > const zaba = polish.getScoredSuggestions( "zaba" );
+            assert( zaba.empty() == false );
+            assert( zaba[ 0 ] == ( Suggestion{ "żaba", 1, 0 } ) );
+
+            std::vector< std::string > const zle = polish.getSuggestions( "źle" );
+            assert( zle.size() >= 2 && zle[ 0 ] == "źle" && zle[ 1 ] == "zle" );
+
+            assert( Alphabet::toLower( 0x17B ) == 0x17C );
+            assert( Alphabet::toLower( 0x141 ) == 0x142 );
+            assert( Alphabet::toLower( 0x15A ) == 0x15B );
+            assert( Alphabet::toLower( 0xDC ) == 0xFC );
+            assert( Alphabet::toLower( 0x17C ) == 0x17C );
+            assert( Alphabet::toLower( 0xD7 ) == 0xD7 );
+
+            std::istringstream input( "Żaba, Łąka i Źle; Łaka" );
+            std::ostringstream output;
+
+            DocumentChecker checker( polish );
+            checker.check( input, output );
+
+            assert( checker.misspellings_ == 2 );
+            assert( output.str().find( "\tŁaka\t" ) != std::string::npos );
+
+            polish.dictionary_.trie().save( fileName );
+        }
+
+        {
+            SpellChecker mapped( fileName );
+            assert( mapped.getScoredSuggestions( "zaba" )[ 0 ] == ( Suggestion{ "żaba", 1, 0 } ) );
+        }
+
+        std::remove( fileName );
+
+        assert( sc.getScoredSuggestions( "Ataturk" )[ 0 ] == ( Suggestion{ "Atatürk", 1, 0 } ) );
+
+        {
+            /*
+             * Words of equal penalty keep the order they have in the final
+             * frontier, which the nodes of non-ASCII letters take part in.
+             * Without the non-ASCII words of english the lists are exactly
+             * those of the byte per letter trie, "sister" included.
+             */
+
+            char fileName[] = "/tmp/spellChecker-XXXXXX";
+            int const fd = ::mkstemp( fileName );
+            assert( fd != -1 );
+            ::close( fd );
+
+            {
+                SymSpellIndex const & index = sc.dictionary_.symSpellIndex();
+                std::ofstream file( fileName );
+
+                for( std::uint32_t id = 0 ; id < index.size() ; ++ id ){
+                    std::string const word = index.word( id );
+
+                    if( std::all_of( word.begin(), word.end(), []( char const c ){ return static_cast< unsigned char >( c ) < 0x80; } ) ){
+                        file << word << "\n";
+                    }
+                }
+            }
+
+            SpellChecker ascii( fileName );
+            std::remove( fileName );
+
+            std::vector< std::string > const expected = {
+                "sister", "Sister", "sitter", "sifter", "mister", "Mister", "sifted",
+                "misted", "kisser", "sissier", "sited", "mistier", "dissed", "site",
+                "sassed", "sieved", "kissed", "missed"
+            };
+
+            assert( ascii.getSuggestions( "sister" ) == expected );
+            assert( ascii.getSuggestions( "boys" ) == sc.getSuggestions( "boys" ) );
+        }
+
+        assert( sc.getSuggestions( "ż" ) == std::vector< std::string >( 1, "ż" ) );
+        assert( sc.getSuggestions( "\xff" ) == std::vector< std::string >( 1, "\xff" ) );
+
+        sc.beginSession();
+        sc.appendLetter( 0x17C );
+        assert( SpellChecker::toWords( sc.currentSuggestions() ) == std::vector< std::string >( 1, "ż" ) );
+        sc.beginSession();
+    }
+
+    {
+        assert( FlatTrie::quantize( 0 ) == 0 );
+        assert( FlatTrie::quantize( 1 ) == 1 );
+        assert( FlatTrie::quantize( 2 ) == 5 );
+        assert( FlatTrie::quantize( 1000 ) < FlatTrie::quantize( 1500 ) );
+        assert( FlatTrie::quantize( std::uint64_t( 1 ) << 40 ) == FlatTrie::MaxFrequency );
+
+        assert( Dictionary::splitFrequency( "word" ) == 4 );
+        assert( Dictionary::splitFrequency( "word 12" ) == 4 );
+        assert( Dictionary::splitFrequency( "word\t12" ) == 4 );
+        assert( Dictionary::splitFrequency( "word 1a" ) == 7 );
+        assert( Dictionary::splitFrequency( "word " ) == 5 );
+        assert( Dictionary::splitFrequency( " 12" ) == 3 );
+
+        {
+            std::string const lines = "b\nab 2\n\na\nb 1\nabc";
+            WordList const words( lines.data(), lines.data() + lines.size() );
+
+            assert( words.size() == 5 );
+            assert( std::string( words.begin( 1 ), words.end( 1 ) ) == "ab" );
+            assert( std::string( words.begin( 4 ), words.end( 4 ) ) == "abc" );
+            assert( words.frequencies_[ 1 ] == FlatTrie::quantize( 2 ) );
+            assert( words.frequencies_[ 3 ] == FlatTrie::quantize( 1 ) );
+            assert( words.frequencies() );
+
+            FlatTrie const trie = Dictionary::build( words, 2 );
+
+            assert( trie.size() == 5 );
+            assert( trie.letter( trie.begin( FlatTrie::Root ) ) == 'b' );
+            assert( trie.contains( "abc", "abc" + 3 ) );
+            assert( trie.contains( "ab", "ab" + 2 ) );
+            assert( trie.contains( "bc", "bc" + 2 ) == false );
+        }
+
+        char fileName[] = "/tmp/spellChecker-XXXXXX";
+        int const fd = ::mkstemp( fileName );
+        assert( fd != -1 );
+        ::close( fd );
+
+        {
+            std::ofstream file( fileName );
+            file << "mane 1\nman\t10\nmae 100000\nmne 1\nmanes\n";
+        }
+
+        std::vector< Suggestion > const expected = {
+            { "mane", 0, 1 }, { "mae", 3, FlatTrie::quantize( 100000 ) },
+            { "man", 3, FlatTrie::quantize( 10 ) }, { "mne", 3, 1 }
+        };
+
+        {
+            SpellChecker frequencies( fileName );
+            FlatTrie const & trie = frequencies.dictionary_.trie();
+
+            assert( trie.frequencies() );
+            assert( frequencies.contains( "mae" ) );
+            assert( frequencies.contains( "mae 100000" ) == false );
+
+            std::vector< Suggestion > const suggestions = frequencies.getScoredSuggestions( "mane" );
+            assert( suggestions == expected );
+
+            for( unsigned i = 0 ; i < expected.size() ; ++ i ){
+                assert( suggestions[ i ].frequency_ == expected[ i ].frequency_ );
+            }
+
+            assert( frequencies.getSuggestions( "mane", 2 ) == std::vector< std::string >( { "mane", "mae" } ) );
+
+            frequencies.options_.engine_ = SearchOptions::BestFirst;
+            assert( frequencies.getScoredSuggestions( "mane" ) == expected );
+            assert( frequencies.getSuggestions( "mane", 2 ) == std::vector< std::string >( { "mane", "mae" } ) );
+
+            frequencies.options_.engine_ = SearchOptions::SymSpell;
+            assert( frequencies.getScoredSuggestions( "mane" ) == expected );
+
+            frequencies.options_.engine_ = SearchOptions::Lockstep;
+
+            assert( SpellChecker::toWords( frequencies.getCompletions( "ma", 3 ) ) == std::vector< std::string >( { "mae", "man", "mane" } ) );
+        }
+
+        {
+            SpellChecker dawg( fileName );
+
+            auto const maxFrequencies = [ & dawg ](){
+                std::vector< unsigned > result;
+
+                for( std::string const prefix : { "", "m", "ma", "man", "mn", "mae" } ){
+                    FlatTrie const & trie = dawg.dictionary_.trie();
+                    result.push_back( dawg.dictionary_.maxFrequency( trie.find( prefix.data(), prefix.data() + prefix.size() ) ) );
+                }
+
+                return result;
+            };
+
+            std::vector< unsigned > const expectedFrequencies = maxFrequencies();
+            assert( expectedFrequencies[ 4 ] == 1 );
+
+            dawg.dictionary_.setTrie( FlatTrie::minimize( dawg.dictionary_.trie() ) );
+
+            assert( dawg.dictionary_.trie().frequencies() );
+            assert( maxFrequencies() == expectedFrequencies );
+            assert( dawg.getScoredSuggestions( "mane" ) == expected );
+            assert( dawg.getSuggestions( "mane", 2 ) == std::vector< std::string >( { "mane", "mae" } ) );
+            assert( SpellChecker::toWords( dawg.getCompletions( "ma", 3 ) ) == std::vector< std::string >( { "mae", "man", "mane" } ) );
+        }
+
+        {
+            std::ofstream file( fileName );
+            std::uint32_t frequency = 1;
+
+            for( std::string const & word : randomWords( sc.dictionary_.trie(), 20000, 4 ) ){
+                frequency = frequency * 1103515245u + 12345u;
+
+                std::string decoded = word;
+                sc.dictionary_.trie().alphabet_.decode( decoded );
+                file << decoded << " " << ( frequency >> 12 ) << "\n";
+            }
+
+            for( std::string const & word : microbenchWords ){
+                file << word << "\n";
+            }
+        }
+
+        {
+            SpellChecker frequencies( fileName );
+
+            DefaultPenaltyPolicy const policy( & frequencies.dictionary_.keyboardLayout_ );
+
+            auto const ranks = [ & policy ]( std::vector< Suggestion > const & suggestions ){
+                std::vector< int > result;
+
+                for( Suggestion const & suggestion : suggestions ){
+                    result.push_back( policy.rank( suggestion.penalty_, suggestion.frequency_ ) );
+                }
+
+                return result;
+            };
+
+            for( std::string const & word : microbenchWords ){
+                std::vector< Suggestion > const all = frequencies.getScoredSuggestions( word );
+                std::vector< int > const allRanks = ranks( all );
+
+                assert( std::is_sorted( allRanks.begin(), allRanks.end() ) );
+
+                for( unsigned limit = 1 ; limit <= 10 ; limit += 3 ){
+                    std::vector< Suggestion > const expected( all.begin(), all.begin() + std::min< std::size_t >( limit, all.size() ) );
+
+                    assert( frequencies.getScoredSuggestions( word, limit ) == expected );
+                }
+            }
+        }
+
+        {
+            std::ofstream file( fileName, std::ios::app );
+            file << "\nłąka 3\nżaba\nłąka 7\r\nzebra 1\nend";
+        }
+
+        {
+            FlatTrie const reference = Dictionary::readByNodes( fileName );
+            MappedFile const file( fileName );
+            WordList const words( file.data_, file.data_ + file.size_ );
+
+            for( unsigned const threads : { 1u, 4u, 0u } ){
+                FlatTrie const trie = Dictionary::build( words, threads );
+
+                assert( trie.bytes() == reference.bytes() );
+                assert( std::memcmp( trie.image_, reference.image_, reference.bytes() ) == 0 );
+            }
+
+            assert( words.size() == 20000 + microbenchWords.size() + 5 );
+            assert( std::equal( words.alphabet_.codePoints_, words.alphabet_.codePoints_ + Alphabet::Size, reference.alphabet_.codePoints_ ) );
+        }
+
+        std::remove( fileName );
+    }
+
+    {
+        FlatTrie const & trie = sc.dictionary_.trie();
+        DefaultPenaltyPolicy const policy( & sc.dictionary_.keyboardLayout_ );
+
+        std::vector< std::string > const prefixes = { "", "s", "sp", "spel", "hcek", "Alexa", "zzz", "mitigat" };
+
+        for( std::string const & prefix : prefixes ){
+            SearchContext & context = sc.context_;
+            context.init();
+
+            for( unsigned i = 0 ; i < prefix.size() ; ++ i ){
+                context.processLetter( policy, prefix[ i ], i + 1 < prefix.size() ? prefix[ i + 1 ] : char( 0 ) );
+            }
+
+            std::map< std::string, int > best;
+
+            std::function< void( FlatTrie::Index, std::string &, int ) > visit;
+            visit = [ & ]( FlatTrie::Index const node, std::string & word, int const penalty ){
+                if( trie.isEnd( node ) && ( best.count( word ) == 0 || best[ word ] > penalty ) ){
+                    best[ word ] = penalty;
+                }
+
+                for( FlatTrie::Index child = trie.begin( node ) ; child != trie.end( node ) ; ++ child ){
+                    word.push_back( trie.letter( child ) );
+                    visit( child, word, penalty );
+                    word.pop_back();
+                }
+            };
+
+            for( TrieIterator const * const i : context ){
+                std::string word = i->word();
+                visit( i->node_, word, i->penalty_ );
+            }
+
+            context.finalize();
+
+            std::vector< std::pair< std::pair< int, std::size_t >, std::string > > ranked;
+
+            for( auto const & word : best ){
+                ranked.emplace_back( std::make_pair( word.second, word.first.size() ), word.first );
+            }
+
+            std::sort( ranked.begin(), ranked.end() );
+
+            for( unsigned const limit : { 1u, 5u, 8u, 20u } ){
+                std::vector< Suggestion > const completions = sc.getCompletions( prefix, limit );
+
+                assert( completions.size() == std::min< std::size_t >( limit, ranked.size() ) );
+
+                for( unsigned i = 0 ; i < completions.size() ; ++ i ){
+                    assert( completions[ i ].word_ == ranked[ i ].second );
+                    assert( completions[ i ].penalty_ == ranked[ i ].first.first );
+                }
+            }
+        }
+
+        assert( SpellChecker::toWords( sc.getCompletions( "spel", 3 ) ) == std::vector< std::string >( { "spell", "spelt", "spells" } ) );
+
+        /*
+         * limit 0 means all completions, as for suggestions
+         */
+
+        {
+            std::vector< Suggestion > const all = sc.getCompletions( "spel", 0 );
+            std::vector< Suggestion > const best = sc.getCompletions( "spel", 20 );
+
+            assert( all.size() > best.size() );
+            assert( std::equal( best.begin(), best.end(), all.begin() ) );
+        }
+
+        std::vector< Suggestion > const completions = sc.getCompletions( "hcek", 20 );
+
+        sc.dictionary_.setTrie( FlatTrie::minimize( trie ) );
+        assert( sc.getCompletions( "hcek", 20 ) == completions );
+        sc.dictionary_.setTrie( trie );
+    }
+
+    {
+        std::vector< std::string > const words = {
+            "sister", "mitigate", "Alexander", "hcekcre", "splel", "abracadabra"
+        };
+
+        for( std::string const & word : words ){
+            sc.beginSession();
+            assert( sc.currentSuggestions() == sc.getScoredSuggestions( "" ) );
+
+            for( unsigned i = 0 ; i < word.size() ; ++ i ){
+                sc.appendLetter( word[ i ] );
+                assert( sc.currentSuggestions() == sc.getScoredSuggestions( word.substr( 0, i + 1 ) ) );
+            }
+
+            assert( sc.currentSuggestions( 3 ) == sc.getScoredSuggestions( word, 3 ) );
+
+            for( unsigned i = word.size() ; i -- > 1 ; ){
+                sc.backspace();
+                assert( sc.currentSuggestions() == sc.getScoredSuggestions( word.substr( 0, i ) ) );
+            }
+        }
+
+        sc.beginSession();
+
+        for( char const c : std::string( "sisx" ) ){
+            sc.appendLetter( c );
+        }
+
+        sc.backspace();
+        sc.appendLetter( 't' );
+        sc.appendLetter( 'e' );
+        sc.appendLetter( 'r' );
+        assert( sc.currentSuggestions() == sc.getScoredSuggestions( "sister" ) );
+
+        sc.backspace();
+        sc.backspace();
+        sc.backspace();
+        sc.backspace();
+        sc.backspace();
+        sc.backspace();
+        sc.backspace();
+        assert( sc.currentSuggestions() == sc.getScoredSuggestions( "" ) );
+
+        /*
+         * paths made after a snapshot are taken back with it
+         */
+
+        for( char const c : std::string( "sis" ) ){
+            sc.appendLetter( c );
+        }
+
+        unsigned const paths = sc.sessionContext_.paths_.used_;
+
+        for( char const c : std::string( "ter" ) ){
+            sc.appendLetter( c );
+            sc.currentSuggestions();
+        }
 
-        std::istringstream iss1( polishKeyboardLayout );
-        keyboardLayout_.addLayout( 1, iss1 );
+        assert( sc.sessionContext_.paths_.used_ > paths );
 
-        std::istringstream iss2( polishKeyboardShiftLayout );
-        keyboardLayout_.addLayout( 0, iss2 );
+        sc.backspace();
+        sc.backspace();
+        sc.backspace();
+        assert( sc.sessionContext_.paths_.used_ == paths );
+        assert( sc.currentSuggestions() == sc.getScoredSuggestions( "sis" ) );
 
-        TrieStats ts( trie_ );
+        sc.beginSession();
 
-        if( Debug ){
-            std::cout << "Nodes counter: " << ts.nodesCounter_ << std::endl;
-            std::cout << "Leaves counter: " << ts.leavesCounter_ << std::endl;
-            std::cout << "Avg. children/node: " << 1.0 * ts.childrenCounter_ / ts.nodesCounter_ << std::endl;
-            std::cout << "Words counter: " << ts.wordsCounter_ << std::endl;
-            std::cout << "Node with one child: " << ts.nodeWithOneChildCounter_ << std::endl;
+        for( std::uint32_t const codePoint : std::vector< std::uint32_t >( { 'A', 't', 'a', 't', 0xFC, 'r', 'k' } ) ){
+            sc.appendLetter( codePoint );
         }
-    }
 
-    std::vector< std::string > getSuggestionsImpl( std::string const & word ){
-        if( word.size() < 2 ){
-            return std::vector< std::string >( 1, word );
-        }
+        assert( sc.currentSuggestions() == sc.getScoredSuggestions( "Atatürk" ) );
+        assert( sc.currentSuggestions()[ 0 ] == ( Suggestion{ "Atatürk", 0, 0 } ) );
 
-        PenaltyPolicy penaltyPolicy( & keyboardLayout_ );
-        init( & penaltyPolicy );
+        sc.options_.deduplicate_ = true;
+        sc.options_.parallelThreshold_ = 64;
+        sc.options_.parallelThreads_ = 3;
 
-        for( unsigned i = 1 ; i < word.size() ; ++ i ){
-            processLetter( word[ i - 1 ], word[ i ] );
+        sc.beginSession();
 
-            if( Debug ){
-                for( auto const & i : (*this) ){
-                    std::cout << "> " << i->word_ << " " << i->debug_ << " " << i->penalty_ << std::endl;
-                }
-                std::cout << std::endl;
-            }
+        for( char const c : std::string( "zoologists" ) ){
+            sc.appendLetter( c );
         }
 
-        processLetter( word[ word.size() - 1 ] );
+        assert( sc.currentSuggestions() == sc.getScoredSuggestions( "zoologists" ) );
 
-        std::vector< TrieIterator * > iterators( begin(), end() );
+        /*
+         * so are the paths of the workers
+         */
 
-        std::sort(
-            iterators.begin(),
-            iterators.end(),
-            []( TrieIterator const * const lhs, TrieIterator const * const rhs ){
-                return lhs->penalty_ < rhs->penalty_;
-            }
-        );
+        sc.options_.parallelThreshold_ = 1;
+        sc.beginSession();
 
-        std::vector< std::string > result;
+        for( char const c : std::string( "zoologist" ) ){
+            sc.appendLetter( c );
+        }
 
-        for( auto const & i : iterators ){
-            if( i->node_->end_ ){
+        std::vector< unsigned > workerPaths;
 
-                if( Debug ){
-                    std::cout << "> " << i->word_ << " " << i->debug_ << " " << i->penalty_ << std::endl;
-                }
+        for( auto const & worker : sc.sessionContext_.workers_ ){
+            workerPaths.push_back( worker->paths_.used_ );
+        }
 
-                if( contain( result, i->word_ ) == false ){
-                    result.push_back( i->word_ );
-                }
+        assert( workerPaths.empty() == false );
+
+        for( unsigned i = 0 ; i < 5 ; ++ i ){
+            sc.appendLetter( 's' );
+            sc.currentSuggestions();
+            sc.backspace();
+
+            for( unsigned worker = 0 ; worker < workerPaths.size() ; ++ worker ){
+                assert( sc.sessionContext_.workers_[ worker ]->paths_.used_ == workerPaths[ worker ] );
+                assert( sc.sessionContext_.workers_[ worker ]->pool_.used_ == 0 );
             }
         }
 
-        finalize();
+        assert( sc.currentSuggestions() == sc.getScoredSuggestions( "zoologist" ) );
 
-        return result;
+        sc.options_.deduplicate_ = false;
+        sc.options_.parallelThreshold_ = 0;
+        sc.options_.parallelThreads_ = 0;
     }
 
-    std::vector< std::string > getSuggestions( std::string const & word ){
-        if( Debug ){
-            std::vector< std::string > result;
-            test( [ this, & word, & result ](){ result = this->getSuggestionsImpl( word ); } );
-            return result;
+    {
+        std::vector< std::string > const words = { "teh", "recieve", "spell", "zzzzzzzzzzzz" };
+        std::vector< std::vector< Suggestion > > expected;
+
+        for( std::string const & word : words ){
+            expected.push_back( sc.getScoredSuggestions( word ) );
         }
-        else{
-            return this->getSuggestionsImpl( word );
+
+        assert( sc.resultCache_.enabled() == false );
+        assert( sc.cacheStats().misses_ == 0 );
+
+        sc.setCacheCapacity( 3 );
+
+        for( unsigned i = 0 ; i < words.size() ; ++ i ){
+            assert( sc.getScoredSuggestions( words[ i ] ) == expected[ i ] );
+        }
+
+        CacheStats stats = sc.cacheStats();
+        assert( stats.misses_ == 4 && stats.hits_ == 0 );
+        assert( stats.entries_ == 3 && stats.evictions_ == 1 );
+
+        assert( sc.getScoredSuggestions( "zzzzzzzzzzzz" ) == expected[ 3 ] );
+        assert( sc.getScoredSuggestions( "recieve" ) == expected[ 1 ] );
+        assert( sc.stats().cached_ == Stats );
+        assert( sc.stats().created_[ 0 ] == 0 && sc.stats().pruned_.empty() );
+
+        assert( sc.getScoredSuggestions( "teh" ) == expected[ 0 ] );
+        assert( sc.stats().cached_ == false );
+
+        stats = sc.cacheStats();
+        assert( stats.hits_ == 2 && stats.misses_ == 5 && stats.evictions_ == 2 );
+        assert( sc.stats().cache_.hits_ == 2 );
+
+        std::vector< Suggestion > const top = sc.getScoredSuggestions( "teh", 2 );
+        assert( top.size() == 2 && top[ 0 ].penalty_ == expected[ 0 ][ 0 ].penalty_ );
+        assert( sc.cacheStats().misses_ == 6 );
+
+        sc.options_.engine_ = SearchOptions::BestFirst;
+        sc.getScoredSuggestions( "teh" );
+        assert( sc.cacheStats().misses_ == 7 );
+        sc.options_.engine_ = SearchOptions::Lockstep;
+
+        sc.options_.acceptKnownWords_ = true;
+
+        assert( sc.getScoredSuggestions( "spell" ) == std::vector< Suggestion >( 1, Suggestion{ "spell", 0, 0 } ) );
+        assert( sc.getScoredSuggestions( "spell" ) == std::vector< Suggestion >( 1, Suggestion{ "spell", 0, 0 } ) );
+        assert( sc.cacheStats().knownHits_ == 1 );
+
+        sc.options_.acceptKnownWords_ = false;
+
+        sc.setCacheCapacity( 0, 4 * ResultCache::EntryOverhead );
+
+        for( std::string const & word : microbenchWords ){
+            sc.getScoredSuggestions( word );
+            assert( sc.cacheStats().bytes_ <= 4 * ResultCache::EntryOverhead );
+        }
+
+        sc.setCacheCapacity( 1000 );
+
+        std::vector< std::string > batch;
+
+        for( unsigned i = 0 ; i < 8 ; ++ i ){
+            batch.insert( batch.end(), words.begin(), words.end() );
+        }
+
+        std::vector< std::vector< std::string > > const actual = sc.getSuggestionsBatch( batch, 4 );
+
+        for( unsigned i = 0 ; i < batch.size() ; ++ i ){
+            assert( actual[ i ] == SpellChecker::toWords( expected[ i % words.size() ] ) );
         }
+
+        /*
+         * each of the 4 workers may miss a word before another one stores it
+         */
+
+        assert( sc.cacheStats().hits_ >= 2 + 1 + batch.size() - 4 * words.size() );
+
+        sc.setCacheCapacity( 0 );
+        assert( sc.cacheStats().entries_ == 0 && sc.cacheStats().bytes_ == 0 );
     }
 
-    KeyboardLayout keyboardLayout_;
-};
+    if( Stats ){
+        std::vector< Suggestion > const suggestions = sc.getScoredSuggestions( "mitigate" );
+        QueryStats const serial = sc.stats();
 
-void test( SpellChecker & sc )
-{
-    {
-        std::vector< std::string > const actual = sc.getSuggestions( "english" );
-        std::vector< std::string > const expected = {
-            "English", "neglig", "enlist"
-        };
-        assert( actual == expected );
+        assert( serial.pruned_.size() == 8 );
+        assert( serial.peakFrontier_ > 0 );
+        assert( serial.nodesVisited_ > 0 );
+
+        for( unsigned i = 0 ; i < 5 ; ++ i ){
+            assert( serial.created_[ i ] > 0 );
+        }
+
+        sc.options_.parallelThreshold_ = 1;
+        sc.options_.parallelThreads_ = 3;
+
+        assert( sc.getScoredSuggestions( "mitigate" ) == suggestions );
+
+        QueryStats const parallel = sc.stats();
+
+        assert( std::equal( serial.created_, serial.created_ + 5, parallel.created_ ) );
+        assert( parallel.pruned_ == serial.pruned_ );
+        assert( parallel.nodesVisited_ == serial.nodesVisited_ );
+
+        sc.options_.parallelThreshold_ = 0;
+        sc.options_.parallelThreads_ = 0;
+
+        std::ostringstream json;
+        serial.print( json );
+
+        assert( json.str().find( "{\"created\":{\"E\":" ) == 0 );
+        assert( json.str().find( "\"pruned\":[" ) != std::string::npos );
+
+        sc.options_.engine_ = SearchOptions::BestFirst;
+        sc.getScoredSuggestions( "mitigate" );
+
+        QueryStats const bestFirst = sc.stats();
+
+        assert( bestFirst.peakFrontier_ > 0 );
+        assert( bestFirst.nodesVisited_ > 0 );
+        assert( bestFirst.created_[ 0 ] > 0 );
+
+        sc.options_.engine_ = SearchOptions::BitParallel;
+        sc.getScoredSuggestions( "mitigate" );
+
+        QueryStats const bitParallel = sc.stats();
+
+        assert( bitParallel.peakFrontier_ > 0 );
+        assert( bitParallel.nodesVisited_ > 0 );
+
+        sc.options_.engine_ = SearchOptions::Lockstep;
+
+        /*
+         * a completion counts only its own letters
+         */
+
+        sc.getCompletions( "mitig", 5 );
+        assert( sc.stats().pruned_.size() == 5 );
+        assert( sc.stats().peakFrontier_ > 0 );
     }
+}
 
-    {
-        std::vector< std::string > const actual = sc.getSuggestions( "spell" );
-        std::vector< std::string > const expected = {
-            "spell", "swell","Aspell", "sell", "Ispell", "spool", "spelt"
-        };
-        assert( actual == expected );
+/*
+ * main
+ */
+
+int main( int argc, char* argv[] ){
+    auto const usage = [ argv ](){
+        std::cerr << "Usage: " << argv[ 0 ] << " dictfile [--dawg] [--trie-stats] [--dedup] [--parallel] [--accept-known] [--best-first] [--bit-parallel] [--symspell] [--max-distance n] [--top k] [--complete] [--cache entries] [--cache-bytes bytes] [--stats] [--compile file|--stream|--microbench|--bench|--test|word]\n";
+    };
+
+    if( argc < 2 ){
+        usage();
+        return 1;
     }
 
-    {
-        std::vector< std::string > const actual = sc.getSuggestions( "checker" );
-        std::vector< std::string > const expected = { 
-            "checker", "checked", "checks", "chewer",  "cheeked", "heckler", "check",
-            "chewed"
-        };
-        assert( actual == expected );
+    SpellChecker sc( argv[ 1 ] );
+
+    std::vector< std::string > args( argv + 2, argv + argc );
+
+    auto const flag = [ & args ]( std::string const & name ){
+        auto const it = std::find( args.begin(), args.end(), name );
+
+        if( it == args.end() ){
+            return false;
+        }
+
+        args.erase( it );
+        return true;
+    };
+
+    /*
+     * value of an option, left empty when the option is not given; an
+     * option without a value is an error
+     */
+
+    auto const value = [ & args, & usage ]( std::string const & name, std::string & result ){
+        auto const it = std::find( args.begin(), args.end(), name );
+
+        if( it == args.end() ){
+            return true;
+        }
+
+        if( it + 1 == args.end() || ( it + 1 )->empty() ){
+            std::cerr << "missing value for " << name << std::endl;
+            usage();
+            return false;
+        }
+
+        result = * ( it + 1 );
+        args.erase( it, it + 2 );
+        return true;
+    };
+
+    /*
+     * value of an unsigned option, left as it is when the option is not
+     * given; anything but digits, or a number over max, is an error
+     */
+
+    auto const number = [ & value, & usage ]( std::string const & name, unsigned long long const max, unsigned long long & result ){
+        std::string text;
+
+        if( value( name, text ) == false ){
+            return false;
+        }
+
+        if( text.empty() ){
+            return true;
+        }
+
+        if( text.find_first_not_of( "0123456789" ) == std::string::npos ){
+            errno = 0;
+            unsigned long long const parsed = std::strtoull( text.c_str(), nullptr, 10 );
+
+            if( errno != ERANGE && parsed <= max ){
+                result = parsed;
+                return true;
+            }
+        }
+
+        std::cerr << "invalid value for " << name << ": " << text << std::endl;
+        usage();
+        return false;
+    };
+
+    sc.options_.deduplicate_ = flag( "--dedup" );
+
+    sc.options_.acceptKnownWords_ = flag( "--accept-known" );
+
+    if( flag( "--best-first" ) ){
+        sc.options_.engine_ = SearchOptions::BestFirst;
     }
 
-    {
-        std::vector< std::string > const actual = sc.getSuggestions( "a" );
-        std::vector< std::string > const expected = { 
-            "a"
-        };
-        assert( actual == expected );
+    if( flag( "--bit-parallel" ) ){
+        sc.options_.engine_ = SearchOptions::BitParallel;
     }
 
-    {
-        std::vector< std::string > const actual = sc.getSuggestions( "by" );
-        std::vector< std::string > const expected = { 
-            "by", "b", "y", "Ty", "bay", "boy", "buy", "Yb" 
-        };
-        assert( actual == expected );
+    if( flag( "--symspell" ) ){
+        sc.options_.engine_ = SearchOptions::SymSpell;
     }
 
-    {
-        std::vector< std::string > const actual = sc.getSuggestions( "cad" );
-        std::vector< std::string > const expected = { 
-            "cad", "car", "dad", "fad", "sad", "wad", "card", "ad", "Ada", "clad", "scad"
-        };
-        assert( actual == expected );
+    unsigned long long maxDistance = sc.options_.maxDistance_;
+
+    if( number( "--max-distance", std::numeric_limits< unsigned >::max(), maxDistance ) == false ){
+        return 1;
     }
 
-    {
-        std::vector< std::string > const actual = sc.getSuggestions( "boys" );
-        std::vector< std::string > const expected = { 
-            "boys", "boss", "buys", "bows", "bogs", "bobs", "boas", "Boas", "boy",
-            "buoys", "boy's", "Boyd", "bode"
-        };
-        assert( actual == expected );
+    sc.options_.maxDistance_ = maxDistance;
+
+    if( sc.options_.engine_ == SearchOptions::SymSpell && maxDistance > SymSpellIndex::MaxDistance ){
+        std::cerr << "--symspell supports --max-distance up to " << SymSpellIndex::MaxDistance << std::endl;
+        usage();
+        return 1;
     }
 
-    {
-        std::vector< std::string > const actual = sc.getSuggestions( "empty" );
-        std::vector< std::string > const expected = { 
-            "empty"
-        };
-        assert( actual == expected );
+    if( flag( "--parallel" ) ){
+        sc.options_.parallelThreshold_ = 2048;
     }
 
-    {
-        std::vector< std::string > const actual = sc.getSuggestions( "sister" );
-        std::vector< std::string > const expected = { 
-            "sister", "Sister", "sitter", "sifter", "mister", "Mister", "sifted",
-            "misted", "kisser", "sissier", "sited", "mistier", "dissed", "site",
-            "sassed", "sieved", "kissed", "missed"
-        };
-        assert( actual == expected );
+    bool const stats = flag( "--stats" );
+
+    if( stats && Stats == false ){
+        std::cerr << "--stats needs a build with SPELLCHECKER_STATS ( make STATS=1 )" << std::endl;
+        return 1;
     }
 
-    {
-        std::vector< std::string > const actual = sc.getSuggestions( "England" );
-        std::vector< std::string > const expected = { 
-            "England"
-        };
-        assert( actual == expected );
+    if( stats && sc.options_.engine_ == SearchOptions::SymSpell ){
+        std::cerr << "--stats is not supported with --symspell, it walks no trie and keeps no frontier" << std::endl;
+        usage();
+        return 1;
     }
 
-    {
-        std::vector< std::string > const actual = sc.getSuggestions( "mitigate" );
-        std::vector< std::string > const expected = { 
-            "mitigate", "motivate"
-        };
-        assert( actual == expected );
+    unsigned long long top = 0;
+
+    if( number( "--top", std::numeric_limits< unsigned >::max(), top ) == false ){
+        return 1;
     }
 
-    {
-        std::vector< std::string > const actual = sc.getSuggestions( "Alexander" );
-        std::vector< std::string > const expected = { 
-            "Alexander", "Alexandra"
-        };
-        assert( actual == expected );
+    unsigned const limit = top;
+
+    bool const complete = flag( "--complete" );
+
+    unsigned long long cacheEntries = 0;
+    unsigned long long cacheBytes = 0;
+
+    if(
+        number( "--cache", std::numeric_limits< std::size_t >::max(), cacheEntries ) == false
+        || number( "--cache-bytes", std::numeric_limits< std::size_t >::max(), cacheBytes ) == false
+    ){
+        return 1;
     }
 
-    {
-        std::vector< std::string > const actual = sc.getSuggestions( "zoologist" );
-        std::vector< std::string > const expected = { 
-            "zoologist",
-            "zoology"
-        };
-        assert( actual == expected );
+    sc.setCacheCapacity( cacheEntries, cacheBytes );
+
+    auto const answer = [ & sc, limit, complete ]( std::string const & word ){
+        if( complete ){
+            return SpellChecker::toWords( sc.getCompletions( word, limit != 0 ? limit : 10 ) );
+        }
+
+        return sc.getSuggestions( word, limit );
+    };
+
+    bool const trieStats = flag( "--trie-stats" );
+
+    if( trieStats ){
+        TrieStats( sc.dictionary_.trie() ).print( std::cout );
     }
-}
 
-/*
- * main
- */
+    if( flag( "--dawg" ) && sc.dictionary_.trie().minimized() == false ){
+        sc.dictionary_.setTrie( FlatTrie::minimize( sc.dictionary_.trie() ) );
 
-int main( int argc, char* argv[] ){
-    if( argc < 2 ){
-        std::cerr << "Usage: " << argv[ 0 ] << " dictfile [word]\n";
+        if( trieStats ){
+            std::cout << "Minimized:" << std::endl;
+            TrieStats( sc.dictionary_.trie() ).print( std::cout );
+        }
+    }
+
+    std::string compiledFileName;
+
+    if( value( "--compile", compiledFileName ) == false ){
         return 1;
     }
 
-    SpellChecker sc( argv[ 1 ] );
+    if( compiledFileName.empty() == false ){
+        sc.dictionary_.trie().save( compiledFileName );
+        return 0;
+    }
 
-    if( argc == 2 )
+    if( args.empty() )
     {
         while( true ){
             std::string word;
             std::cout << "? ";
-            std::cin >> word;
 
-            for( std::string const & suggestion : sc.getSuggestions( word ) ){
+            if( ! ( std::cin >> word ) ){
+                std::cout << std::endl;
+                break;
+            }
+
+            for( std::string const & suggestion : answer( word ) ){
                 std::cout << suggestion << std::endl;
             }
+
+            if( stats ){
+                sc.stats().print( std::cerr );
+                std::cerr << std::endl;
+            }
         }
     }
     else
     {
-        if( argv[ 2 ] == std::string( "--test" ) ){
+        if( args[ 0 ] == "--test" ){
             test( sc );
         }
+        else if( args[ 0 ] == "--microbench" ){
+            microbench( sc );
+            microbenchLoad( sc, argv[ 1 ] );
+        }
+        else if( args[ 0 ] == "--bench" ){
+            bench( sc );
+        }
+        else if( args[ 0 ] == "--stream" ){
+            using namespace std::chrono;
+
+            std::ios::sync_with_stdio( false );
+
+            DocumentChecker checker( sc );
+
+            steady_clock::time_point const start = steady_clock::now();
+            checker.check( std::cin, std::cout );
+            std::cout.flush();
+            double const seconds = duration< double >( steady_clock::now() - start ).count();
+
+            std::cerr
+                << checker.bytes_ << " bytes, "
+                << checker.words_ << " words, "
+                << checker.misspellings_ << " misspellings in "
+                << seconds << "s, "
+                << checker.bytes_ / 1e6 / std::max( seconds, 1e-9 ) << " MB/s"
+                << std::endl;
+
+            if( sc.resultCache_.enabled() ){
+                std::cerr << "cache: ";
+                sc.cacheStats().print( std::cerr );
+                std::cerr << std::endl;
+            }
+        }
         else{
-            for( std::string const & suggestion : sc.getSuggestions( argv[ 2 ] ) ){
+            for( std::string const & suggestion : answer( args[ 0 ] ) ){
                 std::cout << suggestion << std::endl;
             }
+
+            if( stats ){
+                sc.stats().print( std::cerr );
+                std::cerr << std::endl;
+            }
         }
     }
 
     return 0;
 }
-